@@ -0,0 +1,319 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <random>
+#include <algorithm>
+
+#include "headless_wrapper.hpp"
+#include "our_windows.hpp"
+#include "ourgrid.hpp"
+#include "workbook_generator.hpp"
+
+// Microbenchmarks, run on a headless window, reported as JSON:
+//   ./bench [output.json]
+
+#ifndef OURCALC_VERSION
+#define OURCALC_VERSION "unknown"
+#endif
+
+using BenchW = OW<Headless>;
+
+struct bench_window : BenchW::Window
+{
+	BenchW::Container top_container;
+	BenchW::TextEdit text1;
+	Grid<BenchW> grid1;
+
+	bench_window(const char * title, int width, int height)
+		: BenchW::Window(title, width, height)
+		, top_container(this)
+		, text1(this, "")
+		, grid1(this, text1)
+	{
+		global_grid = &grid1;
+
+		this->top_container.border_width = 0;
+		this->top_container.border_padding = 0;
+		this->top_container.inter_padding = 0;
+		this->top_container.set_layout(std::make_unique<BenchW::VLayout>(horizontal_policy{horizontal_policy::alignment_t::left, horizontal_policy::sizing_t::fill}
+		                                                                ,  vertical_policy{  vertical_policy::alignment_t::top ,   vertical_policy::sizing_t::fill}));
+		this->top_container.add_widget(text1);
+		this->top_container.add_widget(grid1);
+		top_container.set_size({w, h});
+		this->container.add_widget(top_container);
+
+		grid1.take_focus();
+	}
+};
+
+struct bench_result
+{
+	std::string name;
+	std::vector<std::pair<std::string, long long>> params;
+	int ops;
+	std::vector<double> ns_per_op; // one by run
+};
+std::vector<bench_result> results;
+
+inline static const int runs = 5;
+
+// Times f, which does ops operations, a few times
+template<typename F>
+void bench(const std::string & name, std::vector<std::pair<std::string, long long>> params, int ops, F f)
+{
+	bench_result result{name, params, ops, {}};
+	for (int i=0 ; i<runs ; ++i)
+	{
+		auto start = std::chrono::steady_clock::now();
+		f();
+		auto end = std::chrono::steady_clock::now();
+		result.ns_per_op.push_back(std::chrono::duration<double, std::nano>(end - start).count() / ops);
+	}
+	std::cerr << name << " done" << std::endl;
+	results.push_back(result);
+}
+
+std::string to_json()
+{
+	std::ostringstream out;
+	out << "{\n  \"version\": \"" << OURCALC_VERSION << "\",\n  \"runs\": " << runs << ",\n  \"benchmarks\": [";
+	for (size_t i=0 ; i<results.size() ; ++i)
+	{
+		auto & r = results[i];
+		auto sorted = r.ns_per_op;
+		std::sort(std::begin(sorted), std::end(sorted));
+		out << (i ? "," : "") << "\n    {\"name\": \"" << r.name << "\", \"params\": {";
+		for (size_t j=0 ; j<r.params.size() ; ++j)
+			out << (j ? ", " : "") << "\"" << r.params[j].first << "\": " << r.params[j].second;
+		out << "}, \"ops\": " << r.ops
+		    << ", \"ns_per_op_min\": " << sorted.front()
+		    << ", \"ns_per_op_median\": " << sorted[sorted.size()/2] << "}";
+	}
+	out << "\n  ]\n}\n";
+	return out.str();
+}
+
+icu::UnicodeString cell_name(unsigned int col, unsigned int row)
+{
+	return get_cell_name_utf8(col, row);
+}
+
+// sets the first cell of the workbook again and again, recalculating its dependents
+void bench_first_cell_writes(Grid<BenchW> & grid, const workbook_shape & shape)
+{
+	generate_workbook(grid, shape);
+	int k = 0;
+	bench(std::string("set_formula_") + workbook_kind_name(shape.kind), {{"cells", shape.cells}, {"width", shape.width}}, 10, [&]()
+		{
+			for (int i=0 ; i<10 ; ++i)
+			{
+				grid.set_formula_at(0, 0, "=" + icu::UnicodeString::fromUTF8(std::to_string(++k)));
+				grid.wait_for_evaluation();
+			}
+		});
+}
+
+void bench_recalculation(Grid<BenchW> & grid)
+{
+	using kind_t = workbook_shape::kind_t;
+	for (unsigned int n : {100, 1000, 10000})
+		bench_first_cell_writes(grid, {kind_t::chain, n, 1});
+	for (unsigned int n : {100, 1000})
+	{
+		// A0 <- A1 <- ... going through python
+		clear_workbook(grid, 1, n);
+		grid.set_formula_at(0, 0, "=0");
+		for (unsigned int i=1 ; i<n ; ++i)
+			grid.set_formula_at(0, i, "=int(" + cell_name(0, i-1) + ")+1");
+		grid.wait_for_evaluation();
+		int k = 0;
+		bench("set_formula_chain_python", {{"cells", n}}, 10, [&]()
+			{
+				for (int i=0 ; i<10 ; ++i)
+				{
+					grid.set_formula_at(0, 0, "=" + icu::UnicodeString::fromUTF8(std::to_string(++k)));
+					grid.wait_for_evaluation();
+				}
+			});
+	}
+	for (unsigned int n : {100, 1000, 10000, 100000})
+		bench_first_cell_writes(grid, {kind_t::fan_out, n, 10});
+	for (unsigned int n : {1000, 10000})
+		bench_first_cell_writes(grid, {kind_t::fan_in, n, 10});
+	for (unsigned int n : {1000, 10000})
+		bench_first_cell_writes(grid, {kind_t::random_dag, n, 10});
+	for (unsigned int n : {1000, 10000})
+		bench_first_cell_writes(grid, {kind_t::mixed, n, 10});
+
+	// whole workbooks typed in, literals going through try_parse_text
+	for (auto kind : {kind_t::literals, kind_t::random_dag})
+	{
+		unsigned int n = 1000;
+		bench(std::string("generate_") + workbook_kind_name(kind), {{"cells", n}}, n, [&]()
+			{
+				generate_workbook(grid, {kind, n, 10});
+			});
+	}
+}
+
+void bench_structure(Grid<BenchW> & grid)
+{
+	for (unsigned int n : {1000, 10000, 100000})
+	{
+		// n written cells, in 10 columns
+		clear_workbook(grid, 10, n / 10);
+		for (unsigned int i=0 ; i<n ; ++i)
+			grid.set_formula_at(i % 10, i / 10, "=" + icu::UnicodeString::fromUTF8(std::to_string(i)));
+		grid.wait_for_evaluation();
+		bench("insert_rows", {{"cells", n}}, 10, [&]()
+			{
+				for (int i=0 ; i<10 ; ++i)
+					grid.insert_rows(1, 0);
+			});
+		bench("insert_columns", {{"cells", n}}, 10, [&]()
+			{
+				for (int i=0 ; i<10 ; ++i)
+					grid.insert_columns(1, 0);
+			});
+	}
+}
+
+void bench_rendering(bench_window & window, Grid<BenchW> & grid)
+{
+	// a dense sheet, with numbers and texts
+	clear_workbook(grid, 40, 400);
+	for (unsigned int col=0 ; col<40 ; ++col)
+		for (unsigned int row=0 ; row<400 ; ++row)
+			grid.set_formula_at(col, row, (col + row) % 3 ? "=" + icu::UnicodeString::fromUTF8(std::to_string(col * row)) : "text " + cell_name(col, row));
+	grid.wait_for_evaluation();
+	grid.set_active_cell(0, 0);
+	window._redraw();
+
+	bench("redraw_full", {{"width", window.w}, {"height", window.h}}, 10, [&]()
+		{
+			for (int i=0 ; i<10 ; ++i)
+			{
+				grid.invalidate_all_tiles();
+				grid.set_needs_redraw();
+				window._redraw();
+			}
+		});
+	bench("redraw_cached_tiles", {{"width", window.w}, {"height", window.h}}, 10, [&]()
+		{
+			for (int i=0 ; i<10 ; ++i)
+			{
+				grid.set_needs_redraw();
+				window._redraw();
+			}
+		});
+	bench("redraw_scroll", {{"width", window.w}, {"height", window.h}}, 20, [&]()
+		{
+			for (int i=0 ; i<20 ; ++i)
+			{
+				grid.scroll_by(0, i < 10 ? 1 : -1);
+				window._redraw();
+			}
+		});
+	bench("redraw_active_cell_move", {{"width", window.w}, {"height", window.h}}, 20, [&]()
+		{
+			for (int i=0 ; i<20 ; ++i)
+			{
+				Headless::inject_key(window, i < 10 ? Scancode::Down : Scancode::Up);
+				window._redraw();
+			}
+		});
+}
+
+void bench_selection()
+{
+	for (unsigned int n : {100, 1000, 10000})
+	{
+		// n single cells and a few rects, at random in a 1000x1000 area
+		std::mt19937 rng(42);
+		auto random_cell = [&]()
+			{
+				// one call by statement, arguments being evaluated in no particular order
+				unsigned int col = rng() % 1000;
+				unsigned int row = rng() % 1000;
+				return CellCoords{col, row};
+			};
+		Grid<BenchW>::selection_t selection;
+		selection.clear();
+		for (unsigned int i=0 ; i<n ; ++i)
+		{
+			auto p = random_cell();
+			selection.toggle_selected_cell(p.x, p.y);
+		}
+		for (int i=0 ; i<20 ; ++i)
+		{
+			auto a = random_cell();
+			auto b = random_cell();
+			selection.add_rect(a, b);
+		}
+
+		bench("selection_is_cell_selected", {{"cells", n}}, 10000, [&]()
+			{
+				for (unsigned int row=0 ; row<100 ; ++row)
+					for (unsigned int col=0 ; col<100 ; ++col)
+						selection.is_cell_selected(col, row);
+			});
+		bench("selection_does_row_have_selection", {{"cells", n}}, 1000, [&]()
+			{
+				for (unsigned int row=0 ; row<1000 ; ++row)
+				{
+					selection.does_row_have_selection(row);
+					selection.does_col_have_selection(row);
+				}
+			});
+		std::vector<Grid<BenchW>::selection_t::cell_state_t> states;
+		bench("selection_get_cell_states", {{"cells", n}}, 100, [&]()
+			{
+				for (unsigned int i=0 ; i<100 ; ++i)
+					selection.get_cell_states(CellRect({i * 10, i * 10}, {i * 10 + 15, i * 10 + 40}), states);
+			});
+	}
+}
+
+void bench_text(bench_window & window)
+{
+	for (unsigned int length : {10, 100, 1000})
+	{
+		std::string base(length, 'x');
+		Text text(base, &window);
+		bench("text_set_text_typing", {{"length", length}}, 100, [&]()
+			{
+				// typing at the end, the start of the text stays the same
+				std::string s = base;
+				for (int i=0 ; i<100 ; ++i)
+				{
+					s += (char)('a' + i % 26);
+					text.set_text(s);
+				}
+			});
+		bench("text_set_text_replace", {{"length", length}}, 100, [&]()
+			{
+				for (int i=0 ; i<100 ; ++i)
+					text.set_text(std::string(length, (char)('a' + i % 26)));
+			});
+	}
+}
+
+int main(int argc, char ** argv)
+{
+	BenchW::Manager wm;
+	auto & window = (bench_window&)wm.make_window<bench_window>("OurCalc bench", 1920, 1080);
+	auto & grid = window.grid1;
+
+	bench_recalculation(grid);
+	bench_structure(grid);
+	bench_rendering(window, grid);
+	bench_selection();
+	bench_text(window);
+
+	if (argc > 1)
+		std::ofstream(argv[1]) << to_json();
+	else
+		std::cout << to_json();
+	return 0;
+}
@@ -7,6 +7,7 @@ enum event_type
 	window_shown = 1,
 	window_resized,
 	mouse,
+	mouse_wheel,
 	key,
 	text,
 };
@@ -18,6 +19,11 @@ struct mouse_data
 	int button;
 	int x, y;
 };
+struct mouse_wheel_data
+{
+	int x, y;               // mouse position
+	int scroll_x, scroll_y; // positive away from the user and to the right
+};
 struct key_data
 {
 	enum Mods
@@ -61,6 +67,7 @@ struct event
 	{
 		int nothin_sandwich;
 		mouse_data mouse;
+		mouse_wheel_data mouse_wheel;
 		key_data   key;
 		window_resized_data window_resized;
 		text_data  text;
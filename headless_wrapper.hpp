@@ -0,0 +1,144 @@
+
+#pragma once
+
+#include <cstring>
+
+#include "sdl_wrapper.hpp"
+
+// A window drawing into memory with the software renderer, for running
+// the widgets without a display nor a GPU. Its size is fixed.
+struct HeadlessWindow : Window
+{
+	HeadlessWindow([[maybe_unused]]const char * title, int width, int height)
+		: Window(SDL_CreateRGBSurfaceWithFormat(0, width, height, 32, SDL_PIXELFORMAT_ARGB8888))
+	{}
+	virtual ~HeadlessWindow()
+	{
+		// the atlas' textures belong to the renderer
+		glyph_atlas.reset();
+		SDL_DestroyRenderer(renderer);
+		SDL_FreeSurface(winSurface);
+	}
+
+	// last presented frame
+	SDL_Surface * frame_buffer()
+	{
+		return winSurface;
+	}
+	bool save_frame(const char * filename)
+	{
+		return SDL_SaveBMP(winSurface, filename) == 0;
+	}
+	// true if the frame is the same as the one saved in filename, for golden images
+	bool is_frame_like(const char * filename)
+	{
+		SDL_Surface * loaded = SDL_LoadBMP(filename);
+		if ( ! loaded)
+			return false;
+		SDL_Surface * golden = SDL_ConvertSurfaceFormat(loaded, winSurface->format->format, 0);
+		SDL_FreeSurface(loaded);
+		if ( ! golden)
+			return false;
+
+		bool same = golden->w == winSurface->w && golden->h == winSurface->h;
+		for (int y=0 ; same && y<winSurface->h ; ++y)
+			same = 0 == memcmp((char*)golden   ->pixels + y*golden   ->pitch,
+			                   (char*)winSurface->pixels + y*winSurface->pitch,
+			                   winSurface->w * winSurface->format->BytesPerPixel);
+		SDL_FreeSurface(golden);
+		return same;
+	}
+};
+
+// Window system wrapper without a window system: events are injected by
+// the caller, and frames rendered when asked.
+struct Headless
+{
+	using Window_t = HeadlessWindow;
+	using DrawableArea_t = DrawableArea;
+
+	std::vector<std::unique_ptr<Window_t>> windows;
+
+	Headless()
+	{
+		// no video subsystem, the software renderer doesn't need one
+		if ( SDL_Init( SDL_INIT_EVENTS ) < 0 )
+			throw;
+	    TTF_Init();
+	}
+	~Headless()
+	{
+		windows.clear();
+		TTF_Quit();
+		SDL_Quit();
+	}
+
+	template<typename W>
+	W & make_window(const char * title, int width, int height)
+	{
+		windows.emplace_back(std::make_unique<W>(title, width, height));
+		return (W&)*windows.back();
+	}
+
+	// one frame of SDL::loop, without the events
+	void render_frame()
+	{
+		for (auto & window : windows)
+			window->_redraw();
+	}
+	void loop()
+	{
+		render_frame();
+	}
+	// frames are rendered when asked
+	static void wake_up() {}
+
+	// synthetic events, handled as if SDL sent them
+	static void inject(Window_t & window, event ev)
+	{
+		window.handle_event(ev);
+	}
+	static void inject_key(Window_t & window, Scancode keycode, int charcode=0, int mod=key_data::Mods::NONE)
+	{
+		for (bool pressed : {true, false})
+		{
+			event ev{event_type::key, 0};
+			ev.data.key.pressed  = pressed;
+			ev.data.key.released = ! pressed;
+			ev.data.key.keycode  = keycode;
+			ev.data.key.charcode = charcode;
+			ev.data.key.mod      = mod;
+			inject(window, ev);
+		}
+	}
+	static void inject_text(Window_t & window, const char * text)
+	{
+		event ev{event_type::text, 0};
+		ev.data.text.composition   = (char*)text;
+		ev.data.text.cursor_pos    = strlen(text);
+		ev.data.text.selection_len = 0;
+		inject(window, ev);
+	}
+	static void inject_click(Window_t & window, int x, int y, int button=1)
+	{
+		for (bool pressed : {true, false})
+		{
+			event ev{event_type::mouse, 0};
+			ev.data.mouse.pressed  = pressed;
+			ev.data.mouse.released = ! pressed;
+			ev.data.mouse.button = button;
+			ev.data.mouse.x = x;
+			ev.data.mouse.y = y;
+			inject(window, ev);
+		}
+	}
+	static void inject_wheel(Window_t & window, int x, int y, int scroll_x, int scroll_y)
+	{
+		event ev{event_type::mouse_wheel, 0};
+		ev.data.mouse_wheel.x = x;
+		ev.data.mouse_wheel.y = y;
+		ev.data.mouse_wheel.scroll_x = scroll_x;
+		ev.data.mouse_wheel.scroll_y = scroll_y;
+		inject(window, ev);
+	}
+};
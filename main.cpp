@@ -66,9 +66,20 @@ int main()
 		if (i != parse_col_name(number_to_column_code(i)))
 			std::cout << "Bad: " << i << ", col: " << number_to_column_code(i) << " != " << parse_col_name(number_to_column_code(i)) << std::endl;
 
-	/*auto & w = */wm.make_window<my_window>("OurCalc", 1024, 768);
+	auto & w = (my_window&)wm.make_window<my_window>("OurCalc", 1024, 768);
+
+	// OURCALC_PROFILE=report.txt profiles from the start, F12 toggling it
+	auto & grid = w.grid1;
+	if (const char * filename = getenv("OURCALC_PROFILE"))
+	{
+		grid.profile_report_filename = filename;
+		grid.profiler.enabled = true;
+	}
 
 	wm.loop();
 
+	if (grid.profiler.enabled)
+		grid.write_profile_report(grid.profile_report_filename);
+
 	return 0;
 }
@@ -108,6 +108,11 @@ struct vertical_policy
 template<typename WSW>
 struct OW
 {
+	// from any thread, for the loop to draw a frame
+	static void wake_up()
+	{
+		WSW::wake_up();
+	}
 
 	struct Window;
 	struct Container;
@@ -124,6 +129,9 @@ struct OW
 		WSW::DrawableArea_t drawable_area;
 
 		bool needs_redraw = true;
+		// what needs redrawing, in widget coordinates, valid while needs_redraw
+		bool damaged_all = true;
+		std::vector<Rect> damage;
 
 		bool _focus = false;
 		bool _mouse_grabbed = false;
@@ -172,10 +180,7 @@ struct OW
 		void take_focus()
 		{
 			if (parent_container)
-			{
 				parent_container->set_focus(this);
-				set_needs_redraw();
-			}
 		}
 		virtual void set_focus(bool has)
 		{
@@ -204,9 +209,41 @@ struct OW
 
 		void set_needs_redraw()
 		{
+			add_damage(Rect{0, 0, rect.w, rect.h});
+		}
+		// Marks a part of the widget as needing a redraw, and the same part of the parents
+		void add_damage(Rect r)
+		{
+			int x0 = std::max(r.x, 0);
+			int y0 = std::max(r.y, 0);
+			int x1 = std::min(r.x + r.w, rect.w);
+			int y1 = std::min(r.y + r.h, rect.h);
+			if (x0 >= x1 || y0 >= y1)
+				return;
+
+			if ( ! this->needs_redraw)
+			{
+				this->damaged_all = false;
+				this->damage.clear();
+			}
 			this->needs_redraw = true;
+			if ( ! this->damaged_all)
+			{
+				// past a few rects, repainting everything is cheaper than tracking them
+				if ((x0 == 0 && y0 == 0 && x1 == rect.w && y1 == rect.h) || damage.size() >= 32)
+				{
+					this->damaged_all = true;
+					this->damage.clear();
+				}
+				else
+					this->damage.push_back(Rect{x0, y0, x1-x0, y1-y0});
+			}
 			if (parent_container)
-				parent_container->set_needs_redraw();
+				parent_container->add_damage(Rect{rect.x + x0, rect.y + y0, x1-x0, y1-y0});
+		}
+		bool intersects(const Rect & r) const
+		{
+			return r.x < rect.x + rect.w && rect.x < r.x + r.w && r.y < rect.y + rect.h && rect.y < r.y + r.h;
 		}
 
 		virtual void clear_background()
@@ -388,13 +425,38 @@ struct OW
 
 		virtual void _redraw()
 		{
-			layout->rearrange_widgets(*this);
-			this->clear_background();
+			std::vector<Rect> old_rects;
 			for (Widget *  widget : widgets)
+				old_rects.push_back(widget->rect);
+			layout->rearrange_widgets(*this);
+			for (size_t i=0 ; i<widgets.size() ; i++)
+			{
+				const Rect & r = widgets[i]->rect;
+				// a moved widget uncovers parts nobody marked as damaged
+				if (r.x != old_rects[i].x || r.y != old_rects[i].y || r.w != old_rects[i].w || r.h != old_rects[i].h)
+					this->damaged_all = true;
+				if (widgets[i]->needs_redraw)
+					widgets[i]->_redraw();
+			}
+
+			if (this->damaged_all)
 			{
-				if (widget->needs_redraw)
-					widget->_redraw();
-				this->drawable_area.copy_from(widget->drawable_area, widget->rect.x, widget->rect.y);
+				this->clear_background();
+				for (Widget *  widget : widgets)
+					this->drawable_area.copy_from(widget->drawable_area, widget->rect.x, widget->rect.y);
+			}
+			else
+			{
+				// only the damaged parts, the rest of the area is still up to date
+				for (const Rect & r : this->damage)
+				{
+					this->drawable_area.set_clip(r.x, r.y, r.w, r.h);
+					this->clear_background();
+					for (Widget *  widget : widgets)
+						if (widget->intersects(r))
+							this->drawable_area.copy_from(widget->drawable_area, widget->rect.x, widget->rect.y);
+				}
+				this->drawable_area.reset_clip();
 			}
 			this->draw_border();
 			this->needs_redraw = false;
@@ -436,6 +498,17 @@ struct OW
 					}
 					break;
 				}
+				case mouse_wheel:
+				{
+					Widget * widget = find_widget_at(ev.data.mouse_wheel.x, ev.data.mouse_wheel.y);
+					if (widget)
+					{
+						ev.data.mouse_wheel.x -= widget->rect.x;
+						ev.data.mouse_wheel.y -= widget->rect.y;
+						return widget->handle_event(ev);
+					}
+					break;
+				}
 				case key:
 					break;
 				default:
@@ -1599,6 +1672,7 @@ struct OW
 		mouse_grabber mousegrab;
 		std::vector<PopupMenu*> popups;
 		event current_event;
+		std::vector<std::function<void()>> frame_callbacks; // called before each frame
 
 		Window(const char * title, int width, int height)
 			: WSW::Window_t(title, width, height)
@@ -1711,6 +1785,17 @@ struct OW
 					}
 					break;
 				}
+				case mouse_wheel:
+				{
+					Widget * widget = this->container.find_widget_at(ev.data.mouse_wheel.x, ev.data.mouse_wheel.y);
+					if (widget)
+					{
+						ev.data.mouse_wheel.x -= widget->rect.x;
+						ev.data.mouse_wheel.y -= widget->rect.y;
+						widget->handle_event(ev);
+					}
+					break;
+				}
 				default:
 				{
 					Widget * widget = focus;
@@ -1719,12 +1804,13 @@ struct OW
 					break;
 				}
 			}
-			_redraw();
 			return false;
 		}
 
 		virtual void _redraw()
 		{
+			for (auto & f : frame_callbacks)
+				f();
 			if (container.needs_redraw)
 			{
 				container._redraw();
@@ -5,9 +5,18 @@ import operator
 import datetime
 import dateparser
 import ast
+import re
+import os
+import sys
+import shutil
+import pickle
+import multiprocessing
+import multiprocessing.connection
+from multiprocessing import shared_memory
 
 class ourcell:
-    """As per https://stackoverflow.com/a/68932800/231306"""
+    """As per https://stackoverflow.com/a/68932800/231306
+    Replaced by its C++ implementation in the grid, see ourcell.hpp"""
     def __init__(self,val):
         self.set_val(val)
     def coords(self,col,row): # should we hide this from cell formulas?
@@ -20,6 +29,7 @@ class ourcell:
         return self
     def set_val(self, val):
         object.__setattr__(self, '_proxied', val)
+        return val
     def get_val(self):
         return object.__getattribute__(self, '_proxied')
     def get_final_val(self):
@@ -33,15 +43,32 @@ class ourcell:
         try:
             return object.__getattribute__(self, name)
         except AttributeError:
-            return self.get_final_val().getattr(p, name)
+            if name.startswith('__') and name.endswith('__'):
+                raise
+            return getattr(self.get_final_val(), name)
     def __setattr__(self, name, value):
         p = self.get_final_val()
         if hasattr(p, name):
             setattr(p, name, value)
         else:
             setattr(self, name, value)
+    def __reduce__(self):
+        d = object.__getattribute__(self, '__dict__')
+        coords = (d['col'], d['row']) if 'col' in d else None
+        fixed = (d['col_fixed'], d['row_fixed']) if 'col_fixed' in d else None
+        return (_rebuild_ourcell, (d['_proxied'], coords, fixed))
     def __bool__(self):
         return self.get_final_val().__bool__()
+    def __int__(self):
+        return int(self.get_final_val())
+    def __float__(self):
+        return float(self.get_final_val())
+    def __index__(self):
+        return operator.index(self.get_final_val())
+    def __abs__(self):
+        return abs(self.get_final_val())
+    def __iter__(self):
+        return iter(self.get_final_val())
     def __str__(self):
         return self.get_final_val().__str__()
     def __repr__(self):
@@ -190,6 +217,15 @@ class ourcell:
     def __invert__(self):
         return ~ self.get_final_val()
 
+def _rebuild_ourcell(val, coords, fixed):
+    """Unpickles an ourcell, of either implementation."""
+    cell = ourcell(val)
+    if coords is not None:
+        cell.coords(*coords)
+    if fixed is not None:
+        cell.fixed(*fixed)
+    return cell
+
 def make_ourcell(val,col,row,col_fixed,row_fixed): #will work for any object you feed it, but only that object
     if isinstance(val, ourcell) and not col_fixed and not row_fixed:
         return deepcopy(val).coords(col,row).fixed(col_fixed,row_fixed)
@@ -199,6 +235,62 @@ def make_ourcell(val,col,row,col_fixed,row_fixed): #will work for any object you
 def is_ourcell(c):
     return isinstance(c, ourcell)
 
+def column_name(col):
+    result = chr(ord('A') + col % 26)
+    col //= 26
+    while col != 0:
+        col -= 1
+        result = chr(ord('A') + col % 26) + result
+        col //= 26
+    return result
+
+def column_index(name):
+    result = 0
+    for c in name:
+        result = result*26 + ord(c) - ord('A') + 1
+    return result - 1
+
+class ourcells(dict):
+    """Namespace of the formulas. The cells A1, _A1, A_1 and _A_1 are created
+    the first time they are looked up, within col_count x row_count."""
+    name_pattern = re.compile(r'(_?)([A-Z]+)(_?)([0-9]+)')
+    def __init__(self):
+        super().__init__()
+        self.col_count = 0
+        self.row_count = 0
+        self.known = None # if set, the only cells that can be looked up, by their plain names
+    def __missing__(self, name):
+        m = ourcells.name_pattern.fullmatch(name) if isinstance(name, str) else None
+        if m is None or str(int(m.group(4))) != m.group(4):
+            raise KeyError(name)
+        col_fixed = m.group(1) == '_'
+        row_fixed = m.group(3) == '_'
+        col = column_index(m.group(2))
+        row = int(m.group(4))
+        if col >= self.col_count or row >= self.row_count:
+            raise KeyError(name)
+        if self.known is not None and m.group(2) + m.group(4) not in self.known:
+            raise KeyError(name)
+        if col_fixed or row_fixed:
+            cell = make_ourcell(self[m.group(2) + m.group(4)], col, row, col_fixed, row_fixed)
+        else:
+            cell = make_ourcell(None, col, row, False, False)
+        self[name] = cell
+        return cell
+
+def ourrange(cells, col_from, row_from, col_to, row_to):
+    """Values of the non-empty cells of a range, row by row. A1:B2 in formulas."""
+    result = []
+    for row in range(row_from, row_to+1):
+        for col in range(col_from, col_to+1):
+            cell = cells.get(column_name(col) + str(row))
+            if cell is None:
+                continue
+            v = cell.get_final_val()
+            if v is not None and v != '':
+                result.append(v)
+    return result
+
 
 def try_parse_text(raw_text):
     try:
@@ -222,3 +314,160 @@ def TODAY():
 def NOW():
     return datetime.today()
 
+
+
+def _send(conn, shm, data):
+    """Bytes through the shared memory, only their size through the pipe, unless they don't fit."""
+    if len(data) <= shm.size:
+        shm.buf[:len(data)] = data
+        conn.send(len(data))
+    else:
+        conn.send(data)
+
+def _recv(conn, shm):
+    message = conn.recv()
+    return bytes(shm.buf[:message]) if isinstance(message, int) else message
+
+def _evaluate_task(namespace, task, col_count, row_count):
+    """Runs the python code of a cell with the values of its inputs, as the grid would."""
+    if task is None:
+        return ('local',)
+    source, inputs, name = task
+    cells = ourcells()
+    cells.col_count = col_count
+    cells.row_count = row_count
+    for input_name, value in inputs.items():
+        cells[input_name].set_val(value)
+    # other cells, looked up at run time, are unknown here: NameError
+    cells.known = set(inputs) | {name}
+    try:
+        result = eval(source, namespace, cells)
+    except NameError:
+        # a cell name built at run time, only the grid knows its value
+        return ('local',)
+    except Exception as e:
+        return ('error', '%s: %s' % (type(e).__name__, e))
+    value = ('ref', result.col, result.row) if is_ourcell(result) else ('value', result)
+    answer = ('ok', str(result), value)
+    try:
+        pickle.dumps(answer)
+    except Exception:
+        return ('local',)
+    return answer
+
+def _worker_main(conn, shm_name):
+    """Loop of a worker process of worker_pool."""
+    shm = shared_memory.SharedMemory(name=shm_name)
+    namespace = {}
+    exec('from ourcalc import *', namespace)
+    try:
+        while True:
+            try:
+                tasks, col_count, row_count = pickle.loads(_recv(conn, shm))
+            except EOFError:
+                break
+            answers = [_evaluate_task(namespace, task, col_count, row_count) for task in tasks]
+            _send(conn, shm, pickle.dumps(answers))
+    finally:
+        shm.close()
+
+class worker_pool:
+    """Processes with their own interpreter, evaluating independent cells in parallel.
+    A task is the python code of a cell, the values of the cells it refers to and its name, an
+    answer ('ok', display text, ('value', v) or ('ref', col, row)), ('error', message),
+    or ('local',) when the cell must be evaluated by the grid, its values not being picklable
+    or it looking up cells other than those it refers to."""
+    shm_size = 1 << 22
+
+    class worker:
+        pass
+
+    def __init__(self, count):
+        self.count = count
+        self.workers = [] # None for a worker stopped by an interruption, started again when needed
+        self.context = None
+
+    def start(self):
+        self.context = multiprocessing.get_context('spawn')
+        # embedded, sys.executable is the program running the grid
+        python = os.path.join(sys.exec_prefix, 'bin', 'python%d.%d' % sys.version_info[:2])
+        self.context.set_executable(python if os.path.exists(python) else shutil.which('python3'))
+        if not hasattr(sys, 'argv'):
+            sys.argv = ['']
+        self.workers = [self.spawn() for i in range(self.count)]
+
+    def spawn(self):
+        w = worker_pool.worker()
+        w.shm = shared_memory.SharedMemory(create=True, size=worker_pool.shm_size)
+        w.conn, child_conn = self.context.Pipe()
+        w.process = self.context.Process(target=_worker_main, args=(child_conn, w.shm.name), daemon=True)
+        w.process.start()
+        child_conn.close()
+        return w
+
+    def stop(self, w, timeout):
+        w.conn.close()
+        w.process.join(timeout)
+        if w.process.is_alive():
+            w.process.terminate()
+            w.process.join()
+        w.shm.close()
+        w.shm.unlink()
+
+    def close(self):
+        for w in self.workers:
+            if w:
+                self.stop(w, 1)
+        self.workers = []
+
+    def dumps(self, chunk, col_count, row_count):
+        try:
+            return pickle.dumps((chunk, col_count, row_count))
+        except Exception:
+            pass
+        def picklable(task):
+            try:
+                pickle.dumps(task)
+                return True
+            except Exception:
+                return False
+        return pickle.dumps(([task if picklable(task) else None for task in chunk], col_count, row_count))
+
+    def wait(self, indices, cancelled):
+        """Answers of the workers, by index, or None if cancelled() became true meanwhile.
+        The workers still evaluating then are stopped, their formula may never end."""
+        answers = {}
+        waiting = {self.workers[i].conn: i for i in indices}
+        while waiting:
+            if cancelled():
+                for i in waiting.values():
+                    self.stop(self.workers[i], 0)
+                    self.workers[i] = None
+                return None
+            for conn in multiprocessing.connection.wait(list(waiting), 0.01):
+                i = waiting.pop(conn)
+                answers[i] = pickle.loads(_recv(conn, self.workers[i].shm))
+        return answers
+
+    def evaluate(self, tasks, col_count, row_count, cancelled=lambda: False):
+        """Answers of the tasks, in order, or None if cancelled() became true meanwhile."""
+        try:
+            if not self.workers:
+                self.start()
+            self.workers = [w or self.spawn() for w in self.workers]
+            size = -(-len(tasks) // len(self.workers))
+            busy = []
+            for i, w in enumerate(self.workers):
+                chunk = tasks[i*size:(i+1)*size]
+                if not chunk:
+                    break
+                _send(w.conn, w.shm, self.dumps(chunk, col_count, row_count))
+                busy.append(i)
+            answers = self.wait(busy, cancelled)
+            if answers is None:
+                return None
+            return [answer for i in busy for answer in answers[i]]
+        except (EOFError, OSError):
+            # a worker is gone, starting again next time
+            self.close()
+            raise
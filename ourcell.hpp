@@ -0,0 +1,338 @@
+
+#pragma once
+
+#include "pybind11/pybind11.h"
+#include <structmember.h>
+
+#include <cstring>
+
+namespace py = pybind11;
+
+// ourcell of ourcalc.py, the value of a cell in the formulas, made with the C API: its
+// operators are forwarded at the slot level, A1 + B1 costing a few C calls instead of
+// python frames. The worker processes, without it, keep the python class.
+struct ourcell_object
+{
+	PyObject_HEAD
+	PyObject * proxied;
+	// set by coords and fixed, AttributeError until then
+	PyObject * col;
+	PyObject * row;
+	PyObject * col_fixed;
+	PyObject * row_fixed;
+};
+
+inline PyTypeObject * ourcell_type_object = nullptr;
+
+inline bool is_ourcell_object(PyObject * v)
+{
+	return PyObject_TypeCheck(v, ourcell_type_object);
+}
+// The value, references followed. New reference, or nullptr and RecursionError if the
+// references make a cycle, which formulas calling set_val can do.
+inline PyObject * ourcell_final_val(PyObject * v)
+{
+	int hops = 0;
+	for ( ; is_ourcell_object(v) ; ++hops)
+	{
+		if (Py_EnterRecursiveCall(" while following the references of a cell"))
+		{
+			v = nullptr;
+			break;
+		}
+		v = ((ourcell_object*)v)->proxied;
+	}
+	for ( ; hops > 0 ; --hops)
+		Py_LeaveRecursiveCall();
+	Py_XINCREF(v);
+	return v;
+}
+inline void ourcell_set(PyObject ** field, PyObject * v)
+{
+	Py_INCREF(v);
+	Py_XSETREF(*field, v);
+}
+
+inline PyObject * ourcell_new(PyTypeObject * type, [[maybe_unused]]PyObject * args, [[maybe_unused]]PyObject * kwds)
+{
+	auto * self = (ourcell_object*)type->tp_alloc(type, 0);
+	if (self)
+	{
+		Py_INCREF(Py_None);
+		self->proxied = Py_None;
+	}
+	return (PyObject*)self;
+}
+inline int ourcell_init(PyObject * self, PyObject * args, PyObject * kwds)
+{
+	PyObject * val;
+	static const char * keywords[] = {"val", nullptr};
+	if ( ! PyArg_ParseTupleAndKeywords(args, kwds, "O:ourcell", (char**)keywords, &val))
+		return -1;
+	ourcell_set(&((ourcell_object*)self)->proxied, val);
+	return 0;
+}
+inline int ourcell_traverse(PyObject * self, visitproc visit, void * arg)
+{
+	auto * cell = (ourcell_object*)self;
+	Py_VISIT(cell->proxied);
+	Py_VISIT(cell->col);
+	Py_VISIT(cell->row);
+	Py_VISIT(cell->col_fixed);
+	Py_VISIT(cell->row_fixed);
+#if PY_VERSION_HEX >= 0x03090000
+	Py_VISIT(Py_TYPE(self));
+#endif
+	return 0;
+}
+inline int ourcell_clear(PyObject * self)
+{
+	auto * cell = (ourcell_object*)self;
+	Py_CLEAR(cell->proxied);
+	Py_CLEAR(cell->col);
+	Py_CLEAR(cell->row);
+	Py_CLEAR(cell->col_fixed);
+	Py_CLEAR(cell->row_fixed);
+	return 0;
+}
+inline void ourcell_dealloc(PyObject * self)
+{
+	PyTypeObject * type = Py_TYPE(self);
+	PyObject_GC_UnTrack(self);
+	ourcell_clear(self);
+	type->tp_free(self);
+	Py_DECREF(type);
+}
+
+// methods of the python class
+inline PyObject * ourcell_coords(PyObject * self, PyObject * args)
+{
+	auto * cell = (ourcell_object*)self;
+	PyObject * col, * row;
+	if ( ! PyArg_UnpackTuple(args, "coords", 2, 2, &col, &row))
+		return nullptr;
+	ourcell_set(&cell->col, col);
+	ourcell_set(&cell->row, row);
+	Py_INCREF(self);
+	return self;
+}
+inline PyObject * ourcell_fixed(PyObject * self, PyObject * args)
+{
+	auto * cell = (ourcell_object*)self;
+	PyObject * col_fixed, * row_fixed;
+	if ( ! PyArg_UnpackTuple(args, "fixed", 2, 2, &col_fixed, &row_fixed))
+		return nullptr;
+	ourcell_set(&cell->col_fixed, col_fixed);
+	ourcell_set(&cell->row_fixed, row_fixed);
+	Py_INCREF(self);
+	return self;
+}
+inline PyObject * ourcell_set_val(PyObject * self, PyObject * val)
+{
+	ourcell_set(&((ourcell_object*)self)->proxied, val);
+	Py_INCREF(val);
+	return val;
+}
+inline PyObject * ourcell_get_val(PyObject * self, [[maybe_unused]]PyObject * unused)
+{
+	PyObject * v = ((ourcell_object*)self)->proxied;
+	Py_INCREF(v);
+	return v;
+}
+inline PyObject * ourcell_get_final_val(PyObject * self, [[maybe_unused]]PyObject * unused)
+{
+	return ourcell_final_val(self);
+}
+inline PyObject * ourcell_is_reference(PyObject * self, [[maybe_unused]]PyObject * unused)
+{
+	return PyBool_FromLong(is_ourcell_object(((ourcell_object*)self)->proxied));
+}
+// rebuilt by ourcalc._rebuild_ourcell, by either class
+inline PyObject * ourcell_reduce(PyObject * self, [[maybe_unused]]PyObject * unused)
+{
+	auto * cell = (ourcell_object*)self;
+	PyObject * ourcalc = PyImport_ImportModule("ourcalc");
+	if ( ! ourcalc)
+		return nullptr;
+	PyObject * rebuild = PyObject_GetAttrString(ourcalc, "_rebuild_ourcell");
+	Py_DECREF(ourcalc);
+	if ( ! rebuild)
+		return nullptr;
+	PyObject * coords = cell->col && cell->row             ? PyTuple_Pack(2, cell->col      , cell->row      ) : (Py_INCREF(Py_None), Py_None);
+	PyObject * fixed  = cell->col_fixed && cell->row_fixed ? PyTuple_Pack(2, cell->col_fixed, cell->row_fixed) : (Py_INCREF(Py_None), Py_None);
+	PyObject * result = coords && fixed ? Py_BuildValue("(O(OOO))", rebuild, cell->proxied, coords, fixed) : nullptr;
+	Py_DECREF(rebuild);
+	Py_XDECREF(coords);
+	Py_XDECREF(fixed);
+	return result;
+}
+
+// Attributes the cell doesn't have are the value's, except the special ones,
+// which copy and pickle look up on the cell itself
+inline PyObject * ourcell_getattro(PyObject * self, PyObject * name)
+{
+	PyObject * result = PyObject_GenericGetAttr(self, name);
+	if (result || ! PyErr_ExceptionMatches(PyExc_AttributeError))
+		return result;
+	const char * s = PyUnicode_AsUTF8(name);
+	if ( ! s || (strncmp(s, "__", 2) == 0 && strlen(s) > 4 && strcmp(s + strlen(s) - 2, "__") == 0))
+		return nullptr;
+	PyErr_Clear();
+	PyObject * v = ourcell_final_val(self);
+	if ( ! v)
+		return nullptr;
+	result = PyObject_GetAttr(v, name);
+	Py_DECREF(v);
+	return result;
+}
+inline int ourcell_setattro(PyObject * self, PyObject * name, PyObject * value)
+{
+	PyObject * v = ourcell_final_val(self);
+	if ( ! v)
+		return -1;
+	int result = value && PyObject_HasAttr(v, name) ? PyObject_SetAttr(v, name, value) : PyObject_GenericSetAttr(self, name, value);
+	Py_DECREF(v);
+	return result;
+}
+
+// The operators on the values, the cell being either operand
+template<PyObject * (*op)(PyObject*)>
+PyObject * ourcell_unary(PyObject * a)
+{
+	PyObject * v = ourcell_final_val(a);
+	if ( ! v)
+		return nullptr;
+	PyObject * result = op(v);
+	Py_DECREF(v);
+	return result;
+}
+template<PyObject * (*op)(PyObject*, PyObject*)>
+PyObject * ourcell_binary(PyObject * a, PyObject * b)
+{
+	PyObject * va = ourcell_final_val(a);
+	PyObject * vb = va ? ourcell_final_val(b) : nullptr;
+	PyObject * result = vb ? op(va, vb) : nullptr;
+	Py_XDECREF(va);
+	Py_XDECREF(vb);
+	return result;
+}
+inline PyObject * ourcell_power(PyObject * a, PyObject * b, PyObject * c)
+{
+	PyObject * va = ourcell_final_val(a);
+	PyObject * vb = va ? ourcell_final_val(b) : nullptr;
+	PyObject * vc = vb ? ourcell_final_val(c) : nullptr;
+	PyObject * result = vc ? PyNumber_Power(va, vb, vc) : nullptr;
+	Py_XDECREF(va);
+	Py_XDECREF(vb);
+	Py_XDECREF(vc);
+	return result;
+}
+inline PyObject * ourcell_richcompare(PyObject * a, PyObject * b, int op)
+{
+	PyObject * va = ourcell_final_val(a);
+	PyObject * vb = va ? ourcell_final_val(b) : nullptr;
+	PyObject * result = vb ? PyObject_RichCompare(va, vb, op) : nullptr;
+	Py_XDECREF(va);
+	Py_XDECREF(vb);
+	return result;
+}
+inline int ourcell_bool(PyObject * a)
+{
+	PyObject * v = ourcell_final_val(a);
+	if ( ! v)
+		return -1;
+	int result = PyObject_IsTrue(v);
+	Py_DECREF(v);
+	return result;
+}
+inline Py_hash_t ourcell_hash(PyObject * a)
+{
+	PyObject * v = ourcell_final_val(a);
+	if ( ! v)
+		return -1;
+	Py_hash_t result = PyObject_Hash(v);
+	Py_DECREF(v);
+	return result;
+}
+inline int ourcell_ass_subscript(PyObject * a, PyObject * key, PyObject * value)
+{
+	PyObject * v = ourcell_final_val(a);
+	if ( ! v)
+		return -1;
+	int result = value ? PyObject_SetItem(v, key, value) : PyObject_DelItem(v, key);
+	Py_DECREF(v);
+	return result;
+}
+
+// Makes the type, or throws
+inline py::object make_ourcell_type()
+{
+	static PyMethodDef methods[] = {
+		{"coords"       , (PyCFunction)ourcell_coords       , METH_VARARGS, nullptr},
+		{"fixed"        , (PyCFunction)ourcell_fixed        , METH_VARARGS, nullptr},
+		{"set_val"      , (PyCFunction)ourcell_set_val      , METH_O      , nullptr},
+		{"get_val"      , (PyCFunction)ourcell_get_val      , METH_NOARGS , nullptr},
+		{"get_final_val", (PyCFunction)ourcell_get_final_val, METH_NOARGS , nullptr},
+		{"is_reference" , (PyCFunction)ourcell_is_reference , METH_NOARGS , nullptr},
+		{"__reduce__"   , (PyCFunction)ourcell_reduce       , METH_NOARGS , nullptr},
+		{nullptr, nullptr, 0, nullptr},
+	};
+	static PyMemberDef members[] = {
+		{(char*)"col"      , T_OBJECT_EX, offsetof(ourcell_object, col      ), 0, nullptr},
+		{(char*)"row"      , T_OBJECT_EX, offsetof(ourcell_object, row      ), 0, nullptr},
+		{(char*)"col_fixed", T_OBJECT_EX, offsetof(ourcell_object, col_fixed), 0, nullptr},
+		{(char*)"row_fixed", T_OBJECT_EX, offsetof(ourcell_object, row_fixed), 0, nullptr},
+		{nullptr, 0, 0, 0, nullptr},
+	};
+	static PyType_Slot slots[] = {
+		{Py_tp_new        , (void*)ourcell_new},
+		{Py_tp_init       , (void*)ourcell_init},
+		{Py_tp_dealloc    , (void*)ourcell_dealloc},
+		{Py_tp_traverse   , (void*)ourcell_traverse},
+		{Py_tp_clear      , (void*)ourcell_clear},
+		{Py_tp_methods    , (void*)methods},
+		{Py_tp_members    , (void*)members},
+		{Py_tp_getattro   , (void*)ourcell_getattro},
+		{Py_tp_setattro   , (void*)ourcell_setattro},
+		{Py_tp_str        , (void*)ourcell_unary<PyObject_Str>},
+		{Py_tp_repr       , (void*)ourcell_unary<PyObject_Repr>},
+		{Py_tp_hash       , (void*)ourcell_hash},
+		{Py_tp_richcompare, (void*)ourcell_richcompare},
+		{Py_tp_iter       , (void*)ourcell_unary<PyObject_GetIter>},
+		{Py_mp_subscript    , (void*)ourcell_binary<PyObject_GetItem>},
+		{Py_mp_ass_subscript, (void*)ourcell_ass_subscript},
+		{Py_nb_bool         , (void*)ourcell_bool},
+		{Py_nb_add          , (void*)ourcell_binary<PyNumber_Add>},
+		{Py_nb_subtract     , (void*)ourcell_binary<PyNumber_Subtract>},
+		{Py_nb_multiply     , (void*)ourcell_binary<PyNumber_Multiply>},
+		{Py_nb_true_divide  , (void*)ourcell_binary<PyNumber_TrueDivide>},
+		{Py_nb_floor_divide , (void*)ourcell_binary<PyNumber_FloorDivide>},
+		{Py_nb_remainder    , (void*)ourcell_binary<PyNumber_Remainder>},
+		{Py_nb_power        , (void*)ourcell_power},
+		{Py_nb_rshift       , (void*)ourcell_binary<PyNumber_Rshift>},
+		{Py_nb_lshift       , (void*)ourcell_binary<PyNumber_Lshift>},
+		{Py_nb_and          , (void*)ourcell_binary<PyNumber_And>},
+		{Py_nb_or           , (void*)ourcell_binary<PyNumber_Or>},
+		{Py_nb_xor          , (void*)ourcell_binary<PyNumber_Xor>},
+		{Py_nb_negative     , (void*)ourcell_unary<PyNumber_Negative>},
+		{Py_nb_positive     , (void*)ourcell_unary<PyNumber_Positive>},
+		{Py_nb_invert       , (void*)ourcell_unary<PyNumber_Invert>},
+		{Py_nb_absolute     , (void*)ourcell_unary<PyNumber_Absolute>},
+		{Py_nb_int          , (void*)ourcell_unary<PyNumber_Long>},
+		{Py_nb_float        , (void*)ourcell_unary<PyNumber_Float>},
+		{Py_nb_index        , (void*)ourcell_unary<PyNumber_Index>},
+		{0, nullptr},
+	};
+	static PyType_Spec spec = {
+		"ourcalc.ourcell",
+		sizeof(ourcell_object),
+		0,
+		Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,
+		slots,
+	};
+	auto type = py::reinterpret_steal<py::object>(PyType_FromSpec(&spec));
+	if ( ! type)
+		throw py::error_already_set();
+	ourcell_type_object = (PyTypeObject*)type.ptr();
+	return type;
+}
@@ -9,8 +9,18 @@
 #include <vector>
 #include <set>
 #include <map>
+#include <cmath>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <optional>
 #include "our_windows.hpp"
 #include "sdl_wrapper.hpp"
+#include "ourcell.hpp"
 
 namespace py = pybind11;
 
@@ -123,47 +133,1154 @@ public:
 	}
 };
 
+// The rects of a selection made disjoint, the most recent ones covering the older ones,
+// and indexed by slabs of columns, so that finding the rect of a cell is O(log n)
+struct SelRectIndex
+{
+	std::vector<SelRect> disjoint;
+	std::vector<unsigned int> slab_starts; // first column of each slab
+	std::vector<std::vector<int>> slabs; // rects crossing each slab, sorted by row
+
+	void build(const SelRects & rects)
+	{
+		disjoint.clear();
+		for (auto it = rects.rbegin() ; it != rects.rend() ; ++it)
+		{
+			std::vector<SelRect> pieces;
+			for (const auto & d : disjoint)
+				subtract(d, *it, pieces);
+			pieces.push_back(*it);
+			disjoint.swap(pieces);
+		}
+
+		slab_starts.clear();
+		for (const auto & d : disjoint)
+		{
+			slab_starts.push_back(d.upleft.x);
+			slab_starts.push_back(d.downright.x + 1);
+		}
+		std::sort(std::begin(slab_starts), std::end(slab_starts));
+		slab_starts.erase(std::unique(std::begin(slab_starts), std::end(slab_starts)), std::end(slab_starts));
+
+		slabs.assign(slab_starts.size(), {});
+		for (int i=0 ; i<(int)disjoint.size() ; i++)
+		{
+			auto s = std::lower_bound(std::begin(slab_starts), std::end(slab_starts), disjoint[i].upleft.x) - std::begin(slab_starts);
+			for ( ; s < (long)slab_starts.size() && slab_starts[s] <= disjoint[i].downright.x ; s++)
+				slabs[s].push_back(i);
+		}
+		// within a slab the rects span its whole width, so their rows don't overlap
+		for (auto & slab : slabs)
+			std::sort(std::begin(slab), std::end(slab), [&](int a, int b){ return disjoint[a].upleft.y < disjoint[b].upleft.y; });
+	}
+	const SelRect * find(CellCoords p) const
+	{
+		auto it = std::upper_bound(std::begin(slab_starts), std::end(slab_starts), p.x);
+		if (it == std::begin(slab_starts))
+			return nullptr;
+		const auto & slab = slabs[it - std::begin(slab_starts) - 1];
+		auto jt = std::upper_bound(std::begin(slab), std::end(slab), p.y, [&](unsigned int y, int i){ return y < disjoint[i].upleft.y; });
+		if (jt == std::begin(slab))
+			return nullptr;
+		const SelRect & r = disjoint[*(jt-1)];
+		return r.contains(p) ? &r : nullptr;
+	}
+	// pieces of a not covered by b
+	static void subtract(const SelRect & a, const CellRect & b, std::vector<SelRect> & out)
+	{
+		if (a.downright.x < b.upleft.x || b.downright.x < a.upleft.x || a.downright.y < b.upleft.y || b.downright.y < a.upleft.y)
+		{
+			out.push_back(a);
+			return;
+		}
+		unsigned int y0 = std::max(a.upleft.y, b.upleft.y);
+		unsigned int y1 = std::min(a.downright.y, b.downright.y);
+		if (a.upleft.y < b.upleft.y)
+			out.push_back(SelRect(CellRect({a.upleft.x, a.upleft.y}, {a.downright.x, b.upleft.y - 1}), a.is_positive));
+		if (a.downright.y > b.downright.y)
+			out.push_back(SelRect(CellRect({a.upleft.x, b.downright.y + 1}, {a.downright.x, a.downright.y}), a.is_positive));
+		if (a.upleft.x < b.upleft.x)
+			out.push_back(SelRect(CellRect({a.upleft.x, y0}, {b.upleft.x - 1, y1}), a.is_positive));
+		if (a.downright.x > b.downright.x)
+			out.push_back(SelRect(CellRect({b.downright.x + 1, y0}, {a.downright.x, y1}), a.is_positive));
+	}
+};
+
+// A number, or bool, computed without involving python
+struct NativeValue
+{
+	enum class type_t
+	{
+		none = 0,
+		boolean,
+		integer,
+		floating,
+	};
+	type_t type = type_t::none;
+	long long i = 0; // boolean and integer
+	double f = 0;    // floating
+};
+
+// Kind of the value of a cell, classified once when it is evaluated
+enum class value_type_t : unsigned char
+{
+	none = 0, // not evaluated
+	text,
+	integer,
+	floating,
+	complex,
+	boolean,
+	list,
+	binary,
+	other,
+};
+
+// Instruction of a formula compiled to be evaluated without python, see compile_native_formula
+struct NativeOp
+{
+	enum class code_t
+	{
+		constant,
+		cell,
+		negate,
+		plus,
+		add,
+		sub,
+		mul,
+		div,
+		pow,
+		lt,
+		le,
+		gt,
+		ge,
+		eq,
+		ne,
+	};
+	code_t code;
+	NativeValue value = NativeValue(); // constant
+	CellCoords cell = CellCoords{0,0}; // cell
+};
+
+// Time spent evaluating each cell, and recalculating after each edit.
+// Off by default: when disabled, timing a phase is a pointer test.
+struct eval_profiler
+{
+	enum phase_t
+	{
+		parse,      // references, dependencies, compilation
+		native,     // evaluation without python
+		python,     // evaluation by python, including giving it the inputs
+		conversion, // results to strings and numbers
+		display,    // display text and invalidation of the cell
+		phase_count,
+	};
+	inline static const char * phase_names[phase_count] = {"parse", "native", "python", "conversion", "display"};
+
+	struct cell_profile
+	{
+		unsigned long long evaluations = 0;
+		long long ns[phase_count] = {};
+
+		long long total_ns() const
+		{
+			long long total = 0;
+			for (auto t : ns)
+				total += t;
+			return total;
+		}
+	};
+	struct edit_profile
+	{
+		CellCoords cell;
+		size_t evaluated; // the edited cell and its dependents
+		long long ns;
+	};
+
+	using clock = std::chrono::steady_clock;
+
+	// Adds the time elapsed since the previous call to a phase of a cell
+	struct lap_t
+	{
+		cell_profile * cell;
+		clock::time_point last;
+
+		void next(phase_t phase)
+		{
+			if ( ! cell)
+				return;
+			auto now = clock::now();
+			cell->ns[phase] += std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count();
+			last = now;
+		}
+	};
+
+	inline static const size_t max_edits = 1000;
+
+	bool enabled = false;
+	std::map<CellCoords, cell_profile> cells;
+	std::deque<edit_profile> edits; // the last ones
+	unsigned long long edit_count = 0;
+	long long edits_ns = 0;
+
+	lap_t start(CellCoords p, bool evaluation)
+	{
+		if ( ! enabled)
+			return lap_t{nullptr, {}};
+		auto & cell = cells[p];
+		if (evaluation)
+			++cell.evaluations;
+		return lap_t{&cell, clock::now()};
+	}
+	void add(CellCoords p, const cell_profile & profile)
+	{
+		if ( ! enabled)
+			return;
+		auto & cell = cells[p];
+		cell.evaluations += profile.evaluations;
+		for (int i=0 ; i<phase_count ; ++i)
+			cell.ns[i] += profile.ns[i];
+	}
+	clock::time_point start_edit()
+	{
+		return enabled ? clock::now() : clock::time_point();
+	}
+	void end_edit(clock::time_point start, CellCoords p, size_t evaluated)
+	{
+		if ( ! enabled)
+			return;
+		long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+		edits.push_back({p, evaluated, ns});
+		if (edits.size() > max_edits)
+			edits.pop_front();
+		++edit_count;
+		edits_ns += ns;
+	}
+	void clear()
+	{
+		cells.clear();
+		edits.clear();
+		edit_count = 0;
+		edits_ns = 0;
+	}
+
+	// the top_n most expensive cells and the last edits, formula_at giving the cells' formulas
+	template<typename F>
+	void report(std::ostream & out, size_t top_n, F formula_at) const
+	{
+		auto ms = [](long long ns) { return ns / 1e6; };
+		out << std::fixed << std::setprecision(3);
+		out << "Edits: " << edit_count << ", recalculation: " << ms(edits_ns) << " ms";
+		if (edit_count)
+			out << ", " << ms(edits_ns / (long long)edit_count) << " ms by edit";
+		out << std::endl << std::endl;
+
+		std::vector<std::pair<CellCoords, const cell_profile*>> sorted;
+		for (const auto & [p, cell] : cells)
+			sorted.emplace_back(p, &cell);
+		std::sort(std::begin(sorted), std::end(sorted), [](const auto & a, const auto & b) { return a.second->total_ns() > b.second->total_ns(); });
+		if (sorted.size() > top_n)
+			sorted.resize(top_n);
+
+		out << "Most expensive cells (ms)" << std::endl
+		    << std::setw(8) << "cell" << std::setw(12) << "evaluations" << std::setw(12) << "total";
+		for (auto name : phase_names)
+			out << std::setw(12) << name;
+		out << "  formula" << std::endl;
+		for (const auto & [p, cell] : sorted)
+		{
+			out << std::setw(8) << get_cell_name_string(p.x, p.y) << std::setw(12) << cell->evaluations << std::setw(12) << ms(cell->total_ns());
+			for (auto t : cell->ns)
+				out << std::setw(12) << ms(t);
+			std::string formula;
+			formula_at(p).toUTF8String(formula);
+			out << "  " << formula << std::endl;
+		}
+		out << std::endl;
+
+		out << "Last edits (ms)" << std::endl
+		    << std::setw(8) << "cell" << std::setw(12) << "evaluated" << std::setw(12) << "total" << std::endl;
+		for (size_t i = edits.size() > top_n ? edits.size() - top_n : 0 ; i<edits.size() ; ++i)
+			out << std::setw(8) << get_cell_name_string(edits[i].cell.x, edits[i].cell.y) << std::setw(12) << edits[i].evaluated << std::setw(12) << ms(edits[i].ns) << std::endl;
+	}
+};
+
+// What the evaluation thread found for a cell, for the UI thread to show it
+struct eval_result
+{
+	CellCoords cell = CellCoords{0,0};
+	std::string display = std::string();
+	value_type_t type = value_type_t::none;
+	bool error = false;
+	std::string error_msg = std::string();
+	eval_profiler::cell_profile profile = eval_profiler::cell_profile();
+};
+
 struct CellData
 {
 	icu::UnicodeString formula;
-	std::string type;
-	Text display;
+	value_type_t type = value_type_t::none;
+	icu::UnicodeString display = icu::UnicodeString(); // laid out only when drawn, see Grid::cell_texts
 	bool error = false;
 	horizontal_policy h_policy = horizontal_policy{horizontal_policy::alignment_t::none, horizontal_policy::sizing_t::none};
 	std::string error_msg = std::string("");
 	std::set<CellCoords> dependencies = std::set<CellCoords>();
 	std::vector<CellCoords> dependent_cells = {};
+	// dependencies left out of the topological order, because they close a cycle
+	std::set<CellCoords> cyclic_dependencies = std::set<CellCoords>();
+	// position in the topological order of the cells, 0 until the cell has an ordered dependency
+	unsigned long long topo_order = 0;
+
+	// code cached for the formula it was compiled from
+	bool is_compiled = false;
+	icu::UnicodeString compiled_formula = icu::UnicodeString();
+	py::object compiled_code = py::object();
+	std::vector<NativeOp> native_code = {}; // empty if the formula needs python
+	std::vector<CellCoords> references = {};
+
+	// to be evaluated again, drawn as calculating meanwhile
+	bool pending = false;
+
+	// owned by the evaluation thread while it runs, see GridBase::evaluation_pause
+	// value, if it is a number
+	NativeValue number = NativeValue();
+	// value computed without python, not yet known to python
+	bool python_outdated = false;
+	// the last evaluation failed, error being updated when its result is shown
+	bool evaluation_error = false;
+
+	void clear_dependencies(unsigned int col, unsigned int row);
+	void compile();
+	const py::object & get_compiled_code(int col, int row);
+	icu::UnicodeString get_python_code(int col, int row);
+	void prepare(int col, int row);
+	bool evaluate_without_python(int col, int row, eval_result & result, eval_profiler::lap_t & lap);
+	void evaluate_with_python(int col, int row, eval_result & result, eval_profiler::lap_t & lap);
+	void evaluate(int col, int row, eval_result & result, eval_profiler::lap_t & lap)
+	{
+		if ( ! evaluate_without_python(col, row, result, lap))
+			evaluate_with_python(col, row, result, lap);
+	}
+	void set_python_result(int col, int row, const py::tuple & answer, eval_result & result);
+	py::object set_python_value(const py::object & value, eval_result & result);
+	void apply(const eval_result & result);
+	bool set_display(const std::string & text)
+	{
+		auto s = icu::UnicodeString::fromUTF8(text);
+		if (display == s)
+			return false;
+		display = s;
+		return true;
+	}
+	bool set_formula(icu::UnicodeString contents, int col, int row);
+	void add_dependent(unsigned int col, unsigned int row)
+	{
+		auto p = CellCoords{col, row};
+		auto it = std::lower_bound(std::begin(dependent_cells), std::end(dependent_cells), p);
+		if (it == std::end(dependent_cells) || *it != p)
+			dependent_cells.insert(it, p);
+	}
+	void remove_dependent(unsigned int col, unsigned int row)
+	{
+		auto p = CellCoords{col, row};
+		auto it = std::lower_bound(std::begin(dependent_cells), std::end(dependent_cells), p);
+		if (it != std::end(dependent_cells) && *it == p)
+			dependent_cells.erase(it);
+	}
+	horizontal_policy::alignment_t get_horizontal_alignment() const;
+};
+
+void sync_python_values(const std::vector<CellCoords> & cells);
+
+// What the cells need from the grid, whatever draws it
+struct GridBase
+{
+	// next position given in the topological order of the cells
+	unsigned long long next_topo_order = 1;
+
+	// python interpreter
+	// declared before the cells, so that it outlives their compiled code
+	py::scoped_interpreter guard;
+	py::dict globals;
+	py::dict locals; // an ourcells, binding the cells' names on first use
+	py::object ourcell_type; // the C++ one, unless OURCALC_PYTHON_OURCELL is set
+
+	// cells
+	chunked_grid<CellData> cell_data; // only the cells that were written or referenced
+	// sizes of the columns and rows, also giving their count
+	prefix_sum_tree<unsigned int> thickness_cols;
+	prefix_sum_tree<unsigned int> thickness_rows;
+
+	eval_profiler profiler;
+	std::string profile_report_filename = "ourcalc_profile.txt";
+
+	// Evaluation thread, recalculating the pending cells while the UI thread keeps drawing.
+	// While a job runs, the UI thread only reads the cells: it changes them in an
+	// evaluation_pause, which cancels the job and takes the GIL back.
+	struct eval_job
+	{
+		std::vector<CellCoords> cells; // in evaluation order
+		bool profiling = false;
+	};
+	std::thread evaluation_thread;
+	std::unique_ptr<py::gil_scoped_release> gil_released; // by the UI thread, once the evaluation thread runs
+	spsc_queue<eval_job> jobs = spsc_queue<eval_job>(4);
+	spsc_queue<eval_result> results = spsc_queue<eval_result>(4096);
+	std::mutex jobs_mutex; // only for the evaluation thread to sleep
+	std::condition_variable jobs_posted;
+	bool stopping = false; // guarded by jobs_mutex
+	std::atomic<bool> evaluating = false; // a job was posted, and is not done
+	std::atomic<bool> cancel_evaluation = false;
+	std::atomic<unsigned long> evaluation_thread_id = 0;
+	// called by the evaluation thread when results are ready, to wake the UI thread up
+	std::function<void()> on_results = [](){};
+	std::atomic<bool> wake_pending = false; // until the UI thread takes the results
+	// for the evaluation thread to wait while the results are full
+	std::mutex results_mutex;
+	std::condition_variable results_taken;
+	// for the UI thread to wait for results, or the end of the job
+	std::mutex progress_mutex;
+	std::condition_variable evaluation_progress;
+	// worker processes evaluating the wide waves of independent python cells, see worker_pool
+	// in ourcalc.py. OURCALC_WORKERS=0 evaluates every cell in the evaluation thread.
+	unsigned int worker_count = std::thread::hardware_concurrency();
+	inline static const size_t pool_min_cells = 64; // fewer are quicker to evaluate here
+	py::object worker_pool = py::object(); // started with the first wide wave
+	std::atomic<bool> in_pool = false; // waiting for the workers, interrupted by cancel_evaluation only
+	inline static const std::chrono::milliseconds results_interval = std::chrono::milliseconds(50);
+
+	// owned by the UI thread
+	std::set<CellCoords> pending_cells; // their dependents are pending too
+	std::vector<CellCoords> cells_to_release; // emptied while pending
+	eval_profiler::clock::time_point job_posted_at;
+	// how long a frame waits for a recalculation just started, quick ones never showing as pending
+	inline static const std::chrono::milliseconds evaluation_wait = std::chrono::milliseconds(10);
+	bool edit_in_progress = false;
+	eval_profiler::clock::time_point edit_start;
+	CellCoords last_edited_cell = CellCoords{0,0};
+	size_t evaluated_since_edit = 0;
+
+	struct evaluation_pause
+	{
+		std::optional<py::gil_scoped_acquire> gil;
+
+		evaluation_pause(GridBase & grid)
+		{
+			grid.cancel_evaluation_in_progress();
+			gil.emplace();
+		}
+	};
+
+	GridBase()
+	{
+		auto ourcalc = py::module_::import("ourcalc");
+		locals = py::reinterpret_borrow<py::dict>(ourcalc.attr("ourcells")());
+		// before any cell is made, and the formulas' namespace is filled
+		if ( ! getenv("OURCALC_PYTHON_OURCELL"))
+		{
+			try
+			{
+				ourcalc.attr("ourcell") = make_ourcell_type();
+			}
+			catch(std::exception & e)
+			{
+				std::cout << e.what() << " " << __FILE__ << ": " << __LINE__ << std::endl;
+			}
+		}
+		ourcell_type = ourcalc.attr("ourcell");
+		run_python("from ourcalc import *");
+		if (const char * workers = getenv("OURCALC_WORKERS"))
+			worker_count = atoi(workers);
+	}
+	virtual ~GridBase()
+	{
+		if ( ! evaluation_thread.joinable())
+			return;
+		cancel_evaluation = true;
+		interrupt_python_evaluation();
+		{
+			std::lock_guard lock(jobs_mutex);
+			stopping = true;
+		}
+		jobs_posted.notify_one();
+		evaluation_thread.join();
+		// back to the UI thread, for the cells' python objects to be freed
+		gil_released.reset();
+		if (worker_pool)
+			worker_pool.attr("close")();
+	}
+
+	// the cell's content changed, for the grid to draw it again
+	virtual void invalidate_cell(unsigned int col_idx, unsigned int row_idx) =0;
+
+	// Marks the cell and the cells depending on it, directly or not, to be evaluated again
+	void schedule_evaluation(unsigned int col_idx, unsigned int row_idx)
+	{
+		if ( ! edit_in_progress)
+		{
+			edit_in_progress = true;
+			edit_start = profiler.start_edit();
+			evaluated_since_edit = 0;
+		}
+		last_edited_cell = CellCoords{col_idx, row_idx};
+
+		std::vector<CellCoords> to_visit = {CellCoords{col_idx, row_idx}};
+		while ( ! to_visit.empty())
+		{
+			auto p = to_visit.back();
+			to_visit.pop_back();
+			auto * cell = get_cell_at(p.x, p.y);
+			// the cells depending on a pending cell are already pending
+			if ( ! cell || cell->pending)
+				continue;
+			cell->pending = true;
+			pending_cells.insert(p);
+			invalidate_cell(p.x, p.y);
+			for (const auto & d : cell->dependent_cells)
+				to_visit.push_back(d);
+		}
+	}
+
+	// Sorts the cells so that a cell always comes after the ones it depends on.
+	// Cells caught in a circular dependency come last, in no particular order.
+	std::vector<CellCoords> cells_in_evaluation_order(const std::set<CellCoords> & cells)
+	{
+		// for each cell, how many of its dependencies are among the cells
+		std::map<CellCoords, unsigned int> dependencies_count;
+		for (const auto & p : cells)
+			dependencies_count.emplace(p, 0);
+		for (const auto & p : cells)
+		{
+			auto * cell = get_cell_at(p.x, p.y);
+			if ( ! cell)
+				continue;
+			for (const auto & d : cell->dependent_cells)
+			{
+				auto it = dependencies_count.find(d);
+				if (it != dependencies_count.end())
+					++it->second;
+			}
+		}
+
+		// topological sort (Kahn)
+		std::vector<CellCoords> result;
+		result.reserve(dependencies_count.size());
+		for (const auto & [p, count] : dependencies_count)
+			if (count == 0)
+				result.push_back(p);
+		for (size_t i=0 ; i<result.size() ; ++i)
+		{
+			auto * cell = get_cell_at(result[i].x, result[i].y);
+			if ( ! cell)
+				continue;
+			for (const auto & d : cell->dependent_cells)
+			{
+				auto it = dependencies_count.find(d);
+				if (it != dependencies_count.end() && it->second > 0 && --it->second == 0)
+					result.push_back(d);
+			}
+		}
+
+		// circular dependencies
+		if (result.size() < dependencies_count.size())
+			for (const auto & [p, count] : dependencies_count)
+				if (count > 0)
+					result.push_back(p);
+
+		return result;
+	}
+
+	// the formula being evaluated raises KeyboardInterrupt, cancel_evaluation being set
+	void interrupt_python_evaluation()
+	{
+		py::gil_scoped_acquire gil;
+		// the worker pool checks cancel_evaluation, an exception would cut its messages
+		if (evaluating && ! in_pool)
+			PyThreadState_SetAsyncExc(evaluation_thread_id, PyExc_KeyboardInterrupt);
+	}
+	// Stops the job in progress, interrupting its python code, and shows what it computed
+	void cancel_evaluation_in_progress()
+	{
+		if ( ! evaluating)
+			return;
+		cancel_evaluation = true;
+		interrupt_python_evaluation();
+		{
+			std::unique_lock lock(progress_mutex);
+			evaluation_progress.wait(lock, [this]() { return ! evaluating; });
+		}
+		cancel_evaluation = false;
+		apply_evaluation_results();
+	}
+
+	// move(col, row) changes the coordinates of the cells still to evaluate or to release,
+	// when the cells themselves moved
+	template<typename F>
+	void move_pending_cells(F move)
+	{
+		std::set<CellCoords> moved;
+		for (auto p : pending_cells)
+		{
+			move(p.x, p.y);
+			moved.insert(p);
+		}
+		pending_cells = std::move(moved);
+		for (auto & p : cells_to_release)
+			move(p.x, p.y);
+	}
+
+	void apply_evaluation_results()
+	{
+		wake_pending = false;
+		eval_result result;
+		bool taken = false;
+		while (results.pop(result))
+		{
+			taken = true;
+			pending_cells.erase(result.cell);
+			auto * cell = get_cell_at(result.cell.x, result.cell.y);
+			if ( ! cell)
+				continue;
+			profiler.add(result.cell, result.profile);
+			auto lap = profiler.start(result.cell, false);
+			cell->apply(result);
+			// for the calculating mark at least
+			invalidate_cell(result.cell.x, result.cell.y);
+			lap.next(eval_profiler::display);
+			if (cell->formula.length() == 0)
+				cells_to_release.push_back(result.cell);
+			++evaluated_since_edit;
+		}
+		if (taken)
+		{
+			{ std::lock_guard<std::mutex> lock(results_mutex); }
+			results_taken.notify_one();
+		}
+	}
+
+	// Shows the results of the evaluation thread, and gives it the pending cells once it is done.
+	// Returns true when no cell is pending.
+	bool update_evaluation()
+	{
+		bool idle = ! evaluating;
+		apply_evaluation_results();
+		if ( ! idle)
+			return false;
+		if (pending_cells.empty() && cells_to_release.empty())
+			return true;
+
+		if ( ! evaluation_thread.joinable())
+		{
+			evaluation_thread = std::thread([this]() { evaluation_loop(); });
+			gil_released = std::make_unique<py::gil_scoped_release>();
+		}
+
+		evaluation_pause pause(*this);
+		for (const auto & p : cells_to_release)
+			release_cell_if_unused(p.x, p.y);
+		cells_to_release.clear();
+
+		if (pending_cells.empty())
+		{
+			if (edit_in_progress)
+				profiler.end_edit(edit_start, last_edited_cell, evaluated_since_edit);
+			edit_in_progress = false;
+			return true;
+		}
+
+		eval_job job;
+		job.profiling = profiler.enabled;
+		for (auto it = std::begin(pending_cells) ; it != std::end(pending_cells) ; )
+		{
+			auto * cell = get_cell_at(it->x, it->y);
+			if (cell)
+			{
+				// compilation, counted with the parsing of the evaluation
+				auto lap = profiler.start(*it, false);
+				cell->prepare(it->x, it->y);
+				lap.next(eval_profiler::parse);
+			}
+			it = cell ? std::next(it) : pending_cells.erase(it);
+		}
+		job.cells = cells_in_evaluation_order(pending_cells);
+		evaluating = true;
+		job_posted_at = eval_profiler::clock::now();
+		jobs.push(std::move(job));
+		{
+			std::lock_guard lock(jobs_mutex);
+		}
+		jobs_posted.notify_one();
+		return false;
+	}
+	// The UI thread waiting for the evaluation, until the deadline or every cell is up to date
+	bool wait_for_evaluation(eval_profiler::clock::time_point deadline = eval_profiler::clock::time_point::max())
+	{
+		while ( ! update_evaluation())
+		{
+			auto progress = [this]() { return ! evaluating || wake_pending; };
+			std::unique_lock lock(progress_mutex);
+			if (deadline == eval_profiler::clock::time_point::max())
+				evaluation_progress.wait(lock, progress);
+			else if ( ! evaluation_progress.wait_until(lock, deadline, progress))
+				return false;
+		}
+		return true;
+	}
+	// before each frame, waiting a little for the recalculation just started
+	void update_evaluation_for_frame()
+	{
+		if ( ! update_evaluation())
+			wait_for_evaluation(job_posted_at + evaluation_wait);
+	}
+
+	void evaluation_loop()
+	{
+		evaluation_thread_id = PyThread_get_thread_ident();
+		while (true)
+		{
+			eval_job job;
+			{
+				std::unique_lock lock(jobs_mutex);
+				jobs_posted.wait(lock, [&]() { return stopping || jobs.pop(job); });
+				if (stopping)
+					return;
+			}
+			run_job(job);
+		}
+	}
+	// Groups the cells of a job in waves of cells independent of each other, each wave
+	// depending only on the ones before it
+	std::vector<std::vector<CellCoords>> evaluation_waves(const std::vector<CellCoords> & cells)
+	{
+		std::map<CellCoords, size_t> wave_of;
+		for (const auto & p : cells)
+			wave_of.emplace(p, 0);
+		std::vector<std::vector<CellCoords>> waves;
+		for (const auto & p : cells)
+		{
+			size_t wave = 0;
+			for (const auto & d : get_cell_at(p.x, p.y)->dependencies)
+			{
+				auto it = wave_of.find(d);
+				if (it != wave_of.end())
+					wave = std::max(wave, it->second + 1);
+			}
+			wave_of[p] = wave;
+			if (wave >= waves.size())
+				waves.resize(wave + 1);
+			waves[wave].push_back(p);
+		}
+		return waves;
+	}
+
+	// one wake-up until the UI thread takes the results, not to flood its events
+	void notify_results()
+	{
+		if ( ! wake_pending.exchange(true))
+		{
+			on_results();
+			{ std::lock_guard<std::mutex> lock(progress_mutex); }
+			evaluation_progress.notify_all();
+		}
+	}
+	// false if the evaluation was cancelled
+	bool push_result(eval_result && result, eval_profiler::clock::time_point & last_results)
+	{
+		while ( ! results.push(std::move(result)))
+		{
+			if (cancel_evaluation)
+				return false;
+			notify_results();
+			// without the GIL, which an evaluation_pause may be waiting for
+			py::gil_scoped_release release;
+			std::unique_lock<std::mutex> lock(results_mutex);
+			results_taken.wait_for(lock, std::chrono::milliseconds(10));
+		}
+		if (eval_profiler::clock::now() - last_results > results_interval)
+		{
+			notify_results();
+			last_results = eval_profiler::clock::now();
+		}
+		return true;
+	}
+
+	// Evaluates cells independent of each other in the worker processes. Returns false if the
+	// workers couldn't, the cells being left to the evaluation thread. Once cancelled, only the
+	// results evaluated before are left in wave_results.
+	bool evaluate_in_pool(const std::vector<CellCoords> & cells, std::vector<eval_result> & wave_results, bool profiling)
+	{
+		if (worker_count == 0 || cells.size() < pool_min_cells || cancel_evaluation)
+			return false;
+		try
+		{
+			if ( ! worker_pool)
+				worker_pool = py::module_::import("ourcalc").attr("worker_pool")(worker_count);
+
+			auto start = eval_profiler::clock::now();
+			py::list tasks;
+			for (const auto & p : cells)
+			{
+				auto * cell = get_cell_at(p.x, p.y);
+				std::string code;
+				cell->get_python_code(p.x, p.y).toUTF8String(code);
+				sync_python_values(cell->references);
+				py::dict inputs;
+				for (const auto & r : cell->references)
+				{
+					auto name = get_cell_name_string(r.x, r.y);
+					inputs[name.c_str()] = locals[name.c_str()].attr("get_final_val")();
+				}
+				tasks.append(py::make_tuple(code, inputs, get_cell_name_string(p.x, p.y)));
+			}
+
+			in_pool = true;
+			auto answers = worker_pool.attr("evaluate")(tasks, get_col_count(), get_row_count(), py::cpp_function([this]() { return (bool)cancel_evaluation; }));
+			in_pool = false;
+			if (answers.is_none())
+				return false;
+
+			// the time of the wave shared by its cells
+			long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(eval_profiler::clock::now() - start).count() / cells.size();
+			auto answer_list = answers.cast<py::list>();
+			for (size_t i=0 ; i<cells.size() ; ++i)
+			{
+				auto & p = cells[i];
+				auto answer = answer_list[i].cast<py::tuple>();
+				auto & result = wave_results[i];
+				if (profiling)
+					result.profile.ns[eval_profiler::python] += ns;
+				if (answer[0].cast<std::string>() == "local")
+				{
+					auto lap = eval_profiler::lap_t{profiling ? &result.profile : nullptr, eval_profiler::clock::now()};
+					get_cell_at(p.x, p.y)->evaluate_with_python(p.x, p.y, result, lap);
+					// the python code may have been interrupted, this cell and the next ones stay pending
+					if (cancel_evaluation)
+					{
+						wave_results.resize(i);
+						return true;
+					}
+				}
+				else
+					get_cell_at(p.x, p.y)->set_python_result(p.x, p.y, answer, result);
+			}
+			return true;
+		}
+		catch(std::exception & e)
+		{
+			in_pool = false;
+			std::cout << e.what() << " " << __FILE__ << ": " << __LINE__ << std::endl;
+		}
+		catch(...)
+		{
+			in_pool = false;
+			std::cout << "Unknown exception" << " " << __FILE__ << ": " << __LINE__ << std::endl;
+		}
+		return false;
+	}
+
+	void run_job(eval_job & job)
+	{
+		{
+			py::gil_scoped_acquire gil;
+			// an interruption meant for the previous job, that arrived after its last formula
+			PyThreadState_SetAsyncExc(evaluation_thread_id, nullptr);
+
+			auto last_results = eval_profiler::clock::now();
+			for (const auto & wave : evaluation_waves(job.cells))
+			{
+				// the cells needing python, evaluated together after the others
+				std::vector<CellCoords> python_cells;
+				std::vector<eval_result> wave_results;
+				for (const auto & p : wave)
+				{
+					if (cancel_evaluation)
+						break;
+					eval_result result;
+					result.cell = p;
+					auto lap = eval_profiler::lap_t{job.profiling ? &result.profile : nullptr, eval_profiler::clock::now()};
+					if ( ! get_cell_at(p.x, p.y)->evaluate_without_python(p.x, p.y, result, lap))
+					{
+						python_cells.push_back(p);
+						wave_results.push_back(std::move(result));
+					}
+					else if ( ! push_result(std::move(result), last_results))
+						break;
+				}
+				if (cancel_evaluation)
+					break;
+
+				if (evaluate_in_pool(python_cells, wave_results, job.profiling))
+				{
+					for (auto & result : wave_results)
+						if ( ! push_result(std::move(result), last_results))
+							break;
+					continue;
+				}
+				for (size_t i=0 ; i<python_cells.size() ; ++i)
+				{
+					auto & p = python_cells[i];
+					if (cancel_evaluation)
+						break;
+					auto & result = wave_results[i];
+					auto lap = eval_profiler::lap_t{job.profiling ? &result.profile : nullptr, eval_profiler::clock::now()};
+					get_cell_at(p.x, p.y)->evaluate_with_python(p.x, p.y, result, lap);
+					// the python code may have been interrupted, the cell stays pending
+					if (cancel_evaluation || ! push_result(std::move(result), last_results))
+						break;
+				}
+			}
+		}
+		{
+			std::lock_guard<std::mutex> lock(progress_mutex);
+			evaluating = false;
+		}
+		evaluation_progress.notify_all();
+		// always, the UI thread may have looked at evaluating before taking the last wake-up
+		on_results();
+	}
+
+	bool write_profile_report(const std::string & filename, size_t top_n=50)
+	{
+		std::ofstream out(filename);
+		profiler.report(out, top_n, [&](CellCoords p) { return get_formula_at(p.x, p.y); });
+		return (bool)out;
+	}
+
+	void run_python(std::string code)
+	{
+		evaluation_pause pause(*this);
+		try
+		{
+			//std::cout << "Running:" << std::endl
+			//          << code << std::endl;
+			py::exec(code, globals, locals);
+		}
+		catch(std::exception & e)
+		{
+			std::cout << e.what() << " " << __FILE__ << ": " << __LINE__ << std::endl;
+		}
+		catch(...)
+		{
+			std::cout << "Unknown exception" << " " << __FILE__ << ": " << __LINE__ << std::endl;
+		}
+	}
+
+	unsigned int get_col_count() const
+	{
+		return thickness_cols.size();
+	}
+	unsigned int get_row_count() const
+	{
+		return thickness_rows.size();
+	}
+
+	bool type_is_text(value_type_t type)
+	{
+		return type == value_type_t::text;
+	}
+	bool type_is_number(value_type_t type)
+	{
+		return false
+			|| type == value_type_t::integer
+			|| type == value_type_t::floating
+			|| type == value_type_t::complex
+			;
+	}
+	bool type_is_bool(value_type_t type)
+	{
+		return type == value_type_t::boolean;
+	}
+	bool type_is_list(value_type_t type)
+	{
+		return type == value_type_t::list;
+	}
+	bool type_is_binary(value_type_t type)
+	{
+		return type == value_type_t::binary;
+	}
+	horizontal_policy::alignment_t get_horizontal_alignment(value_type_t type)
+	{
+		// TODO: make it a configuration file
+		if (type_is_text(type))
+			return horizontal_policy::alignment_t::left;
+		if (type_is_number(type))
+			return horizontal_policy::alignment_t::right;
+		if (type_is_bool(type))
+			return horizontal_policy::alignment_t::center;
+		if (type_is_binary(type))
+			return horizontal_policy::alignment_t::left;
+		return horizontal_policy::alignment_t::center;
+	}
 
-	bool do_dependencies_depend_on_us(decltype(dependencies) deps, unsigned int col, unsigned int row);
-	void clear_dependencies(unsigned int col, unsigned int row);
-	bool reevaluate(int col, int row);
-	bool set_formula(icu::UnicodeString contents, int col, int row);
-	void add_dependent(unsigned int col, unsigned int row)
+
+	// nullptr for cells that were never written nor referenced
+	CellData * get_cell_at(unsigned int col_idx, unsigned int row_idx)
 	{
-		auto p = CellCoords{col, row};
-		auto it = std::lower_bound(std::begin(dependent_cells), std::end(dependent_cells), p);
-		if (it == std::end(dependent_cells) || *it != p)
-			dependent_cells.insert(it, p);
+		if (row_idx >= get_row_count() || col_idx >= get_col_count())
+			return nullptr;
+		return cell_data.get(col_idx, row_idx);
 	}
-	void remove_dependent(unsigned int col, unsigned int row)
+	CellData * get_or_create_cell_at(unsigned int col_idx, unsigned int row_idx)
 	{
-		auto p = CellCoords{col, row};
-		auto it = std::lower_bound(std::begin(dependent_cells), std::end(dependent_cells), p);
-		if (it != std::end(dependent_cells) && *it == p)
-			dependent_cells.erase(it);
+		if (row_idx >= get_row_count() || col_idx >= get_col_count())
+			return nullptr;
+		return cell_data.get_or_create(col_idx, row_idx, [this]() { return new CellData{""}; });
+	}
+	// frees the cell if nothing is left in it
+	void release_cell_if_unused(unsigned int col_idx, unsigned int row_idx)
+	{
+		CellData * cell = get_cell_at(col_idx, row_idx);
+		if (cell && cell->formula.length() == 0 && cell->dependencies.empty() && cell->dependent_cells.empty() && ! cell->pending)
+			cell_data.erase(col_idx, row_idx);
+	}
+
+	// Adds the dependency edge to the topological order of the cells, or returns false
+	// if it would close a cycle. Only the cells ordered between the two ends of the edge
+	// are visited and reordered (Pearce-Kelly).
+	bool add_to_topological_order(CellCoords dependency, CellCoords dependent)
+	{
+		if (dependency == dependent)
+			return false;
+		auto * from = get_cell_at(dependency.x, dependency.y);
+		auto * to   = get_cell_at(dependent.x, dependent.y);
+		if ( ! from || ! to)
+			return true;
+		if (from->topo_order == 0)
+			from->topo_order = next_topo_order++;
+		if (to->topo_order == 0)
+			to->topo_order = next_topo_order++;
+
+		auto lower = to->topo_order;
+		auto upper = from->topo_order;
+		if (upper < lower)
+			return true;
+
+		// cells depending on the dependent, ordered before the dependency
+		std::vector<CellCoords> forward;
+		std::vector<CellCoords> to_visit = {dependent};
+		std::set<CellCoords> visited = {dependent};
+		while ( ! to_visit.empty())
+		{
+			auto p = to_visit.back();
+			to_visit.pop_back();
+			forward.push_back(p);
+			for (const auto & d : get_cell_at(p.x, p.y)->dependent_cells)
+			{
+				auto * cell = get_cell_at(d.x, d.y);
+				if ( ! cell || cell->cyclic_dependencies.count(p))
+					continue;
+				if (d == dependency)
+					return false;
+				if (cell->topo_order < upper && visited.insert(d).second)
+					to_visit.push_back(d);
+			}
+		}
+
+		// cells the dependency depends on, ordered after the dependent
+		std::vector<CellCoords> backward;
+		to_visit = {dependency};
+		visited = {dependency};
+		while ( ! to_visit.empty())
+		{
+			auto p = to_visit.back();
+			to_visit.pop_back();
+			backward.push_back(p);
+			auto * cell = get_cell_at(p.x, p.y);
+			for (const auto & d : cell->dependencies)
+			{
+				auto * dependency_cell = get_cell_at(d.x, d.y);
+				if ( ! dependency_cell || cell->cyclic_dependencies.count(d))
+					continue;
+				if (dependency_cell->topo_order > lower && visited.insert(d).second)
+					to_visit.push_back(d);
+			}
+		}
+
+		// give the backward cells the first of their positions, keeping the relative orders
+		auto by_order = [this](CellCoords a, CellCoords b)
+			{
+				return get_cell_at(a.x, a.y)->topo_order < get_cell_at(b.x, b.y)->topo_order;
+			};
+		std::sort(std::begin(forward), std::end(forward), by_order);
+		std::sort(std::begin(backward), std::end(backward), by_order);
+		std::vector<unsigned long long> orders;
+		for (const auto & p : backward)
+			orders.push_back(get_cell_at(p.x, p.y)->topo_order);
+		for (const auto & p : forward)
+			orders.push_back(get_cell_at(p.x, p.y)->topo_order);
+		std::sort(std::begin(orders), std::end(orders));
+		auto it = std::begin(orders);
+		for (const auto & p : backward)
+			get_cell_at(p.x, p.y)->topo_order = *it++;
+		for (const auto & p : forward)
+			get_cell_at(p.x, p.y)->topo_order = *it++;
+		return true;
+	}
+	icu::UnicodeString get_formula_at(unsigned int col_idx, unsigned int row_idx)
+	{
+		CellData * cell = get_cell_at(col_idx, row_idx);
+		if ( ! cell)
+			return "";
+		return cell->formula;
+	}
+	void set_formula_at(unsigned int col_idx, unsigned int row_idx, icu::UnicodeString text)
+	{
+		set_formulas({{CellCoords{col_idx, row_idx}, text}});
+	}
+	// Changes many formulas at once: the cells to evaluate again are gathered in a single
+	// pass, and evaluated together in the next job
+	void set_formulas(const std::vector<std::pair<CellCoords, icu::UnicodeString>> & edits)
+	{
+		// formulas written back unchanged, as when the active cell moves, don't interrupt the
+		// evaluation. formula is the UI thread's, read without a pause.
+		auto changed = [this](const std::pair<CellCoords, icu::UnicodeString> & edit)
+			{
+				const auto & [p, text] = edit;
+				if (p.x >= get_col_count() || p.y >= get_row_count())
+					return false;
+				CellData * cell = get_cell_at(p.x, p.y);
+				return cell ? cell->formula != text : text.length() != 0;
+			};
+		if (std::none_of(std::begin(edits), std::end(edits), changed))
+			return;
+
+		evaluation_pause pause(*this);
+		for (const auto & [p, text] : edits)
+		{
+			CellData * cell = text.length() == 0 ? get_cell_at(p.x, p.y) : get_or_create_cell_at(p.x, p.y);
+			if ( ! cell)
+				continue;
+			cell->set_formula(text, p.x, p.y);
+			release_cell_if_unused(p.x, p.y);
+		}
+	}
+	icu::UnicodeString get_value_at(unsigned int col_idx, unsigned int row_idx)
+	{
+		CellData * cell = get_cell_at(col_idx, row_idx);
+		if ( ! cell)
+			return "";
+		return cell->display;
+	}
+	value_type_t get_type_at(unsigned int col_idx, unsigned int row_idx)
+	{
+		CellData * cell = get_cell_at(col_idx, row_idx);
+		if ( ! cell)
+			return value_type_t::none;
+		return cell->type;
 	}
-	horizontal_policy::alignment_t get_horizontal_alignment() const;
 };
 
 template<typename T>
-struct Grid : T::Widget
+struct Grid : T::Widget, GridBase
 {
+	using Rect = typename T::Rect;
+
 	inline static const color_t color_cell_bg                 = color_t(255);
 	inline static const color_t color_text_header             = color_t(32);
 	inline static const color_t color_lines                   = color_t(160);
 	inline static const color_t color_bg_header               = color_t(210);
 	inline static const color_t   selected_cells_overlay      = color_t(128,200,128,96);
 	inline static const color_t unselected_cells_overlay      = color_t(200,200, 64,96);
+	inline static const color_t color_pending                 = color_t(255,160,  0,255);
 	inline static const color_t color_active_cell             = color_t(0);
 	inline static const color_t color_edit_mode_selected_cell = color_t(64,192,64,255);
 	inline static const int header_resizing_area_thickness = 2;
@@ -181,8 +1298,32 @@ struct Grid : T::Widget
 		bool cut; // copied if false
 		CellCoords reference_cell; // active_cell at the moment of copying
 
+		// built again when the rects or the cells change
+		mutable bool index_outdated = true;
+		mutable SelRectIndex rect_index;
+		mutable std::set<unsigned int> rows_with_selected_cells;
+
+		enum class cell_state_t : unsigned char
+		{
+			none = 0,
+			selected,
+			unselected,
+		};
+
+		void update_index() const
+		{
+			if ( ! index_outdated)
+				return;
+			rect_index.build(rects);
+			rows_with_selected_cells.clear();
+			for (const auto & p : selected_cells)
+				rows_with_selected_cells.insert(p.y);
+			index_outdated = false;
+		}
+
 		void clear()
 		{
+			index_outdated = true;
 			  selected_cols .clear();
 			  selected_rows .clear();
 			unselected_cols .clear();
@@ -219,6 +1360,7 @@ struct Grid : T::Widget
 
 		void add_rect(CellCoords old_coords, CellCoords new_coords)
 		{
+			index_outdated = true;
 			CellRect r(old_coords, new_coords);
 			auto it = rects.find(r);
 			if (it != rects.end())
@@ -231,6 +1373,7 @@ struct Grid : T::Widget
 		}
 		void sub_rect(CellCoords old_coords, CellCoords new_coords)
 		{
+			index_outdated = true;
 			CellRect r(old_coords, new_coords);
 			auto it = rects.find(r);
 			if (it != rects.end())
@@ -246,25 +1389,20 @@ struct Grid : T::Widget
 		{
 			if (selected_all && ! unselected_cols.contains(idx))
 				return true;
-			for (auto n : selected_cols)
-				if (idx == n)
-					return true;
-			for (auto p : selected_cells)
-				if (idx == p.x)
-					return true;
-			return false;
+			if (selected_cols.contains(idx))
+				return true;
+			// cells are sorted by column first
+			auto it = selected_cells.lower_bound(CellCoords{idx, 0});
+			return it != std::end(selected_cells) && it->x == idx;
 		}
 		bool does_row_have_selection(unsigned int idx) const
 		{
 			if (selected_all && ! unselected_rows.contains(idx))
 				return true;
-			for (auto n : selected_rows)
-				if (idx == n)
-					return true;
-			for (auto p : selected_cells)
-				if (idx == p.y)
-					return true;
-			return false;
+			if (selected_rows.contains(idx))
+				return true;
+			update_index();
+			return rows_with_selected_cells.contains(idx);
 		}
 
 		bool is_cell_selected(unsigned int col_idx, unsigned int row_idx) const
@@ -274,9 +1412,9 @@ struct Grid : T::Widget
 				return true;
 			if (unselected_cells.contains(p))
 				return false;
-			for (const auto & rect : rects)
-				if (rect.contains(p))
-					return rect.is_positive;
+			update_index();
+			if (const SelRect * rect = rect_index.find(p))
+				return rect->is_positive;
 			if (selected_all)
 			{
 				if (unselected_rows.contains(row_idx) || unselected_cols.contains(col_idx))
@@ -292,9 +1430,9 @@ struct Grid : T::Widget
 				return true;
 			if (selected_cells.contains(p))
 				return false;
-			for (const auto & rect : rects)
-				if (rect.contains(p))
-					return rect.is_positive == false;
+			update_index();
+			if (const SelRect * rect = rect_index.find(p))
+				return rect->is_positive == false;
 			if (selected_all)
 			{
 				if (selected_rows.contains(row_idx) || selected_cols.contains(col_idx))
@@ -304,6 +1442,62 @@ struct Grid : T::Widget
 			return (unselected_rows.contains(row_idx) || unselected_cols.contains(col_idx));
 		}
 
+		// States of the cells in area, row by row, without testing each cell:
+		// painted by layers, each covering the previous one as is_cell_selected does
+		void get_cell_states(const CellRect & area, std::vector<cell_state_t> & states) const
+		{
+			unsigned int cols = area.downright.x - area.upleft.x + 1;
+			unsigned int rows = area.downright.y - area.upleft.y + 1;
+			states.assign(cols * rows, cell_state_t::none);
+			auto paint = [&](unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1, cell_state_t state)
+				{
+					x0 = std::max(x0, area.upleft.x);
+					y0 = std::max(y0, area.upleft.y);
+					x1 = std::min(x1, area.downright.x);
+					y1 = std::min(y1, area.downright.y);
+					if (x0 > x1 || y0 > y1)
+						return;
+					for (unsigned int y=y0 ; y<=y1 ; y++)
+						for (unsigned int x=x0 ; x<=x1 ; x++)
+							states[(y - area.upleft.y) * cols + x - area.upleft.x] = state;
+				};
+
+			// whole rows and columns, from a flag for each one crossing the area
+			auto flags = [](const std::set<unsigned int> & indices, unsigned int first, unsigned int last)
+				{
+					std::vector<bool> result(last - first + 1, false);
+					for (auto it = indices.lower_bound(first) ; it != std::end(indices) && *it <= last ; ++it)
+						result[*it - first] = true;
+					return result;
+				};
+			auto col_sel   = flags(  selected_cols, area.upleft.x, area.downright.x);
+			auto col_unsel = flags(unselected_cols, area.upleft.x, area.downright.x);
+			auto row_sel   = flags(  selected_rows, area.upleft.y, area.downright.y);
+			auto row_unsel = flags(unselected_rows, area.upleft.y, area.downright.y);
+			for (unsigned int y=0 ; y<rows ; y++)
+				for (unsigned int x=0 ; x<cols ; x++)
+				{
+					bool sel   = row_sel  [y] || col_sel  [x];
+					bool unsel = row_unsel[y] || col_unsel[x];
+					if (selected_all)
+						states[y * cols + x] = ! unsel ? cell_state_t::selected : sel ? cell_state_t::unselected : cell_state_t::none;
+					else
+						states[y * cols + x] = sel ? cell_state_t::selected : unsel ? cell_state_t::unselected : cell_state_t::none;
+				}
+
+			// rects, then single cells
+			update_index();
+			for (const auto & r : rect_index.disjoint)
+				paint(r.upleft.x, r.upleft.y, r.downright.x, r.downright.y, r.is_positive ? cell_state_t::selected : cell_state_t::unselected);
+			for (unsigned int x=area.upleft.x ; x<=area.downright.x ; x++)
+			{
+				for (auto it = unselected_cells.lower_bound(CellCoords{x, area.upleft.y}) ; it != std::end(unselected_cells) && it->x == x && it->y <= area.downright.y ; ++it)
+					paint(x, it->y, x, it->y, cell_state_t::unselected);
+				for (auto it = selected_cells.lower_bound(CellCoords{x, area.upleft.y}) ; it != std::end(selected_cells) && it->x == x && it->y <= area.downright.y ; ++it)
+					paint(x, it->y, x, it->y, cell_state_t::selected);
+			}
+		}
+
 		/*
 		bool is_cell_inside_selection(unsigned int col_idx, unsigned int row_idx) const
 		{
@@ -361,10 +1555,12 @@ struct Grid : T::Widget
 
 		void clear_selected_cells_in_row(  unsigned int row_idx)
 		{
+			index_outdated = true;
 			std::erase_if(selected_cells, [&](const auto & p){ return p.y == row_idx; });
 		}
 		void clear_selected_cells_in_col(  unsigned int col_idx)
 		{
+			index_outdated = true;
 			std::erase_if(selected_cells, [&](const auto & p){ return p.x == col_idx; });
 		}
 		void clear_unselected_cells_in_row(unsigned int row_idx)
@@ -382,6 +1578,7 @@ struct Grid : T::Widget
 
 		void toggle_selected_cell(unsigned int col_idx, unsigned int row_idx)
 		{
+			index_outdated = true;
 			auto p = CellCoords{col_idx, row_idx};
 
 			// search individual cells
@@ -391,15 +1588,16 @@ struct Grid : T::Widget
 				return;
 
 			// search rects
-			for (auto & r : rects)
-				if (r.contains(p))
-				{
-					if (r.is_positive)
-						unselected_cells.insert(p);
-					else
-						selected_cells.insert(p);
-					return;
-				}
+			update_index();
+			if (const SelRect * r = rect_index.find(p))
+			{
+				if (r->is_positive)
+					unselected_cells.insert(p);
+				else
+					selected_cells.insert(p);
+				index_outdated = true;
+				return;
+			}
 
 			// search cols and rows
 			if (is_col_selected(col_idx) || is_row_selected(row_idx))
@@ -422,17 +1620,32 @@ struct Grid : T::Widget
 	Window * parent_window;
 	T::TextEdit & editor;
 
-	// cells
-	std::vector<std::vector<CellData>> cell_data;
 	const Text error_display;
+	// texts of the visible cells and headers
+	inline static const size_t default_text_cache_budget = 8 << 20;
+	TextCache cell_texts;
+	TextCache header_texts;
 
 	// headers
 	unsigned int header_cols_height = 18;
 	unsigned int header_rows_width = 40;
-	std::vector<unsigned int> thickness_cols;
-	std::vector<unsigned int> thickness_rows;
-	std::deque<Text> header_captions_cols;
-	std::deque<Text> header_captions_rows;
+	// rendered cells, by squares of the sheet, so that scrolling mostly copies them
+	struct tile_t
+	{
+		std::unique_ptr<DrawableArea> area;
+		bool valid = false;
+		unsigned long long last_used = 0; // frame
+	};
+	inline static const long long tile_size = 256;
+	inline static const size_t max_tiles = 384; // 96 MiB of textures, more than a 4K window shows
+	std::unordered_map<unsigned long long, tile_t> tiles; // by column of tiles << 32 | row of tiles
+	std::vector<std::unique_ptr<DrawableArea>> free_tile_areas;
+	unsigned long long frame_count = 0;
+
+	// scroll position: first visible column and row
+	unsigned int scroll_col = 0;
+	unsigned int scroll_row = 0;
+	inline static const int wheel_scroll_lines = 3;
 
 	// selection stuff
 	selection_t selection;
@@ -448,16 +1661,13 @@ struct Grid : T::Widget
 	CellCoords active_cell;
 	CellCoords edit_mode_selected_cell;
 
-	// python interpreter
-	py::scoped_interpreter guard;
-	py::dict globals;
-	py::dict locals;
-
 	Grid(T::Window * window, T::TextEdit & edit)
 		: T::Widget(window, {0,0,200,200})
 		, parent_window(window)
 		, editor(edit)
 		, error_display(std::string("Error"), window, 255,0,0,255)
+		, cell_texts(window, SDL_Color{64,64,64,255}, default_text_cache_budget)
+		, header_texts(window, SDL_Color{(uint8_t)color_text_header.r, (uint8_t)color_text_header.g, (uint8_t)color_text_header.b, 255}, default_text_cache_budget)
 		, active_cell{std::numeric_limits<unsigned int>::max(),std::numeric_limits<unsigned int>::max()}
 	{
 		this->border_width = 0;
@@ -465,31 +1675,14 @@ struct Grid : T::Widget
 		this-> inter_padding = 0;
 		this->color_bg = 160;
 
-		run_python("from ourcalc import *");
-
 		insert_columns(20, 0);
 		insert_rows(100, 0);
 
 		set_active_cell(0,0);
 
-	}
+		on_results = []() { T::wake_up(); };
+		window->frame_callbacks.push_back([this]() { update_evaluation_for_frame(); });
 
-	void run_python(std::string code)
-	{
-		try
-		{
-			//std::cout << "Running:" << std::endl
-			//          << code << std::endl;
-			py::exec(code, globals, locals);
-		}
-		catch(std::exception & e)
-		{
-			std::cout << e.what() << " " << __FILE__ << ": " << __LINE__ << std::endl;
-		}
-		catch(...)
-		{
-			std::cout << "Unknown exception" << " " << __FILE__ << ": " << __LINE__ << std::endl;
-		}
 	}
 
 	virtual int  width_packed() { return 0; }
@@ -501,13 +1694,10 @@ struct Grid : T::Widget
 		unsigned int col_count = get_col_count();
 
 		// row count
-		assert(row_count == cell_data.size());
 		assert(row_count == thickness_rows.size());
 		assert(row_count >= selection.selected_rows.size());
 
 		// column count
-		for (auto & row : cell_data)
-			assert(row.size() == col_count);
 		assert(col_count == thickness_cols.size());
 		assert(col_count >= selection.selected_cols.size());
 
@@ -517,34 +1707,6 @@ struct Grid : T::Widget
 		return true;
 	}
 
-	std::string get_cell_defining_code(unsigned int col_idx, unsigned int row_idx) const
-	{
-		const auto cell_name = get_cell_name_string(col_idx,row_idx);
-		const auto col_str = column_name_from_int(col_idx);
-		const auto col_int = std::to_string(col_idx);
-		const auto row_str = std::to_string(row_idx);
-		return std::string(cell_name)
-			.append("=make_ourcell(None,")
-			.append(col_int).append(",").append(row_str)
-			.append(",False,False)\n")
-
-			.append("_").append(cell_name)
-			.append("=make_ourcell(").append(cell_name)
-			.append(",").append(col_int).append(",").append(row_str)
-			.append(",True,False)\n")
-
-			.append(col_str).append("_").append(row_str)
-			.append("=make_ourcell(").append(cell_name)
-			.append(",").append(col_int).append(",").append(row_str)
-			.append(",False,True)\n")
-
-			.append("_").append(col_str).append("_").append(row_str)
-			.append("=make_ourcell(").append(cell_name)
-			.append(",").append(col_int).append(",").append(row_str)
-			.append(",True,True)\n")
-			;
-	}
-
 	void insert_columns(unsigned int count, unsigned int before_idx)
 	{
 		assert(has_integrity());
@@ -552,23 +1714,13 @@ struct Grid : T::Widget
 		if (before_idx > get_col_count())
 			return;
 		
-		std::string code;
-		int row_number = 0;
-		for (auto & row : cell_data)
-		{
-			row.insert(std::next(std::begin(row), before_idx), count, {"", "", Text(parent_window)});
-
-			for (unsigned int col_number=before_idx,i=0 ; i<count ; ++i,++col_number)
-				code.append(get_cell_defining_code(col_number, row_number));
-			++row_number;
-		}
-		thickness_cols.insert(std::next(std::begin(thickness_cols), before_idx), count, 50);
-
-		run_python(code);
-
-		// column headers
-		for (decltype(count) i=0 ; i<count ; ++i)
-			header_captions_cols.emplace_back(number_to_column_code(header_captions_cols.size()), parent_window, color_text_header.r, color_text_header.g, color_text_header.b);
+		// the job in progress is cancelled, its cells left pending are posted again where they moved
+		evaluation_pause pause(*this);
+		cell_data.insert_cols(count, before_idx);
+		move_pending_cells([=](unsigned int & col, unsigned int &) { if (col >= before_idx) col += count; });
+		thickness_cols.insert(before_idx, count, 50);
+		locals.attr("col_count") = get_col_count();
+		invalidate_all_tiles();
 	}
 	void insert_rows(unsigned int count, unsigned int before_idx)
 	{
@@ -577,136 +1729,370 @@ struct Grid : T::Widget
 		if (before_idx > get_row_count())
 			return;
 
-		std::string code;
-		for (unsigned col_number=0 ; col_number < thickness_cols.size() ; ++col_number)
-			for (unsigned int row_number=before_idx,i=0 ; i<count ; ++i,++row_number)
-				code.append(get_cell_defining_code(col_number, row_number));
-
-		cell_data.insert(std::next(std::begin(cell_data), before_idx), count, std::vector<CellData>(count, {"", "", Text(parent_window)}));
-		thickness_rows.insert(std::next(std::begin(thickness_rows), before_idx), count, 18);
-
-		run_python(code);
-
-		// row headers
-		for (decltype(count) i=0 ; i<count ; ++i)
-			header_captions_rows.emplace_back(std::to_string(header_captions_rows.size()), parent_window, color_text_header.r, color_text_header.g, color_text_header.b);
+		evaluation_pause pause(*this);
+		cell_data.insert_rows(count, before_idx);
+		move_pending_cells([=](unsigned int &, unsigned int & row) { if (row >= before_idx) row += count; });
+		thickness_rows.insert(before_idx, count, 18);
+		locals.attr("row_count") = get_row_count();
+		invalidate_all_tiles();
 	}
 
 	int get_total_width()
 	{
-		int total = header_rows_width;
-		for (int t : thickness_cols)
-			total += t;
-		return total;
+		return header_rows_width + thickness_cols.total();
 	}
 	int get_total_height()
 	{
-		int total = header_cols_height;
-		for (int t : thickness_rows)
-			total += t;
-		return total;
+		return header_cols_height + thickness_rows.total();
+	}
+
+	// last column, at least partly, visible
+	unsigned int get_last_visible_col() const
+	{
+		if (get_col_count() == 0)
+			return 0;
+		int width = std::max(1, this->rect.w - (int)header_rows_width);
+		auto idx = thickness_cols.find(thickness_cols.sum(scroll_col) + width - 1);
+		return std::min<unsigned int>(idx, get_col_count()-1);
+	}
+	// last row, at least partly, visible
+	unsigned int get_last_visible_row() const
+	{
+		if (get_row_count() == 0)
+			return 0;
+		int height = std::max(1, this->rect.h - (int)header_cols_height);
+		auto idx = thickness_rows.find(thickness_rows.sum(scroll_row) + height - 1);
+		return std::min<unsigned int>(idx, get_row_count()-1);
+	}
+
+	// first position to scroll to for thickness[idx] to end within size
+	static unsigned int get_scroll_to_show(const prefix_sum_tree<unsigned int> & thickness, unsigned int scroll, unsigned int idx, int size)
+	{
+		if (idx < scroll)
+			return idx;
+		long long end = thickness.sum(idx+1);
+		if (end - (long long)thickness.sum(scroll) <= size)
+			return scroll;
+		// first position with sum(position) >= end-size
+		long long min_start = end - std::max(0, size);
+		unsigned int result = thickness.find(min_start-1) + 1;
+		return std::min(result, idx);
+	}
+	// scrolls as little as possible for the cell to be entirely visible
+	void scroll_to_cell(unsigned int col_idx, unsigned int row_idx)
+	{
+		auto old_scroll_col = scroll_col;
+		auto old_scroll_row = scroll_row;
+
+		if (col_idx < get_col_count())
+			scroll_col = get_scroll_to_show(thickness_cols, scroll_col, col_idx, this->rect.w - header_rows_width);
+		if (row_idx < get_row_count())
+			scroll_row = get_scroll_to_show(thickness_rows, scroll_row, row_idx, this->rect.h - header_cols_height);
+
+		if (scroll_col != old_scroll_col || scroll_row != old_scroll_row)
+			this->set_needs_redraw();
+	}
+	void scroll_by(int cols, int rows)
+	{
+		auto old_scroll_col = scroll_col;
+		auto old_scroll_row = scroll_row;
+		scroll_col = std::clamp((long long)scroll_col + cols, 0ll, std::max(0ll, (long long)get_col_count()-1));
+		scroll_row = std::clamp((long long)scroll_row + rows, 0ll, std::max(0ll, (long long)get_row_count()-1));
+		if (scroll_col != old_scroll_col || scroll_row != old_scroll_row)
+			this->set_needs_redraw();
 	}
 
 	virtual void _redraw() override
+	{
+		++frame_count;
+		if (this->damaged_all)
+			redraw_part(Rect{0, 0, this->rect.w, this->rect.h});
+		else
+		{
+			for (const Rect & r : this->damage)
+			{
+				this->drawable_area.set_clip(r.x, r.y, r.w, r.h);
+				redraw_part(r);
+			}
+			this->drawable_area.reset_clip();
+		}
+		this->draw_border();
+		this->needs_redraw = false;
+		evict_tiles();
+	}
+
+	// Redraws the part of the grid in area, what's outside is expected to be clipped
+	void redraw_part(const Rect & area)
 	{
 		this->clear_background();
 
-		int draw_width  = std::min(this->rect.w, get_total_width ());
-		int draw_height = std::min(this->rect.h, get_total_height());
+		// only the visible part of the sheet is drawn
+		if (get_col_count() == 0 || get_row_count() == 0)
+			return;
+
+		// cells, copied from the tiles crossing the area
+		// sheet coordinates of the top left visible cell
+		long long origin_x = thickness_cols.sum(scroll_col);
+		long long origin_y = thickness_rows.sum(scroll_row);
+		long long sheet_x0 = origin_x + std::max(area.x, (int)header_rows_width) - header_rows_width;
+		long long sheet_y0 = origin_y + std::max(area.y, (int)header_cols_height) - header_cols_height;
+		long long sheet_x1 = std::min(origin_x + area.x + area.w - header_rows_width, (long long)thickness_cols.total());
+		long long sheet_y1 = std::min(origin_y + area.y + area.h - header_cols_height, (long long)thickness_rows.total());
+		for (long long ty = sheet_y0 / tile_size ; ty * tile_size < sheet_y1 ; ++ty)
+			for (long long tx = sheet_x0 / tile_size ; tx * tile_size < sheet_x1 ; ++tx)
+			{
+				DrawableArea & tile = get_tile(tx, ty);
+				long long x0 = std::max(sheet_x0, tx * tile_size);
+				long long y0 = std::max(sheet_y0, ty * tile_size);
+				long long x1 = std::min(sheet_x1, (tx+1) * tile_size);
+				long long y1 = std::min(sheet_y1, (ty+1) * tile_size);
+				this->drawable_area.copy_from(tile, x0 - tx * tile_size, y0 - ty * tile_size, x1 - x0, y1 - y0,
+				                              x0 - origin_x + header_rows_width, y0 - origin_y + header_cols_height);
+			}
+
+		// headers crossing the area
+		unsigned int first_col = scroll_col;
+		unsigned int first_row = scroll_row;
+		unsigned int last_col = get_last_visible_col();
+		unsigned int last_row = get_last_visible_row();
+		if (area.x >= (int)header_rows_width)
+			first_col = std::min<unsigned int>(get_col_at(area.x), last_col);
+		if (area.y >= (int)header_cols_height)
+			first_row = std::min<unsigned int>(get_row_at(area.y), last_row);
+		if (area.x + area.w - 1 >= (int)header_rows_width)
+			last_col = std::min<unsigned int>(get_col_at(area.x + area.w - 1), last_col);
+		else
+			last_col = first_col;
+		if (area.y + area.h - 1 >= (int)header_cols_height)
+			last_row = std::min<unsigned int>(get_row_at(area.y + area.h - 1), last_row);
+		else
+			last_row = first_row;
+
+		// positions of the drawn columns and rows, and of their ends
+		std::vector<int> col_x = {(int)(header_rows_width + thickness_cols.sum(first_col) - origin_x)};
+		for (unsigned int i=first_col ; i<=last_col ; ++i)
+			col_x.push_back(col_x.back() + thickness_cols[i]);
+		std::vector<int> row_y = {(int)(header_cols_height + thickness_rows.sum(first_row) - origin_y)};
+		for (unsigned int i=first_row ; i<=last_row ; ++i)
+			row_y.push_back(row_y.back() + thickness_rows[i]);
 
 		// column headers
-		int x = header_rows_width;
-		unsigned int i = 0;
-		for (int thickness : thickness_cols)
+		for (unsigned int i=first_col ; i<=last_col ; ++i)
 		{
-			int next_x = x + thickness;
+			int x = col_x[i-first_col];
+			int thickness = thickness_cols[i];
 
 			// dark rectangle
 			this->drawable_area.fill_rect(x, 0, thickness-1, header_cols_height-1, color_bg_header.r, color_bg_header.g, color_bg_header.b);
 			bool col_has_selected_cells = selection.does_col_have_selection(i);
 			if (col_has_selected_cells || (!col_has_selected_cells && active_cell.x == i))
 				this->drawable_area.fill_rect(x, 0, thickness-1, header_cols_height-1, selected_cells_overlay.r, selected_cells_overlay.g, selected_cells_overlay.b, selected_cells_overlay.a);
-
-			this->drawable_area.copy_from_text_to_rect_center(header_captions_cols[i], x, 0, thickness, header_cols_height);
-
-			if (x > draw_width)
-				break;
-
-			x = next_x;
-			++i;
 		}
 
 		// row headers
-		int y = header_cols_height;
-		i = 0;
-		for (int thickness : thickness_rows)
+		for (unsigned int i=first_row ; i<=last_row ; ++i)
 		{
-			int next_y = y + thickness;
+			int y = row_y[i-first_row];
+			int thickness = thickness_rows[i];
 
 			// dark rectangle
 			this->drawable_area.fill_rect(0, y, header_rows_width-1, thickness-1, color_bg_header.r, color_bg_header.g, color_bg_header.b);
 			bool row_has_selected_cells = selection.does_row_have_selection(i);
 			if (row_has_selected_cells || (!row_has_selected_cells && active_cell.y == i))
 				this->drawable_area.fill_rect(0, y, header_rows_width-1, thickness-1, selected_cells_overlay.r, selected_cells_overlay.g, selected_cells_overlay.b, selected_cells_overlay.a);
+		}
 
-			this->drawable_area.copy_from_text_to_rect_center(header_captions_rows[i], 0, y, header_rows_width, thickness);
+		// header texts
+		for (unsigned int i=first_col ; i<=last_col ; ++i)
+			this->drawable_area.copy_from_text_to_rect_center(header_texts.get(icu::UnicodeString::fromUTF8(number_to_column_code(i))), col_x[i-first_col], 0, thickness_cols[i], header_cols_height);
+		for (unsigned int i=first_row ; i<=last_row ; ++i)
+			this->drawable_area.copy_from_text_to_rect_center(header_texts.get(icu::UnicodeString::fromUTF8(std::to_string(i))), 0, row_y[i-first_row], header_rows_width, thickness_rows[i]);
 
-			if (y > draw_height)
-				break;
+		// active cell, and cell selected while editing a formula
+		// drawn over the tiles, so that moving them doesn't invalidate any
+		auto draw_cell_border = [&](CellCoords p, color_t color)
+			{
+				Rect r = get_cell_rect(p.x, p.y);
+				if (r.w == 0)
+					return;
+				this->drawable_area.draw_rect(r.x, r.y, r.w-1, r.h-1, color.r, color.g, color.b, color.a);
+			};
+		draw_cell_border(active_cell, color_active_cell);
+		if (edit_mode && edit_mode_select_cell && edit_mode_selected_cell != active_cell)
+			draw_cell_border(edit_mode_selected_cell, color_t(color_active_cell.r, color_edit_mode_selected_cell.g, color_edit_mode_selected_cell.b, color_edit_mode_selected_cell.a));
+	}
 
-			y = next_y;
-			++i;
-		}
+	// Renders the cells in the tile at tx, ty, in sheet coordinates divided by tile_size
+	void render_tile(DrawableArea & tile, long long tx, long long ty)
+	{
+		tile.fill(this->color_bg.r, this->color_bg.g, this->color_bg.b, this->color_bg.a);
 
-		// cells
-		y = header_cols_height;
-		unsigned int row_idx = 0;
-		for (int thickness_row : thickness_rows)
+		long long tile_x = tx * tile_size;
+		long long tile_y = ty * tile_size;
+		if (tile_x >= thickness_cols.total() || tile_y >= thickness_rows.total())
+			return;
+		unsigned int first_col = thickness_cols.find(tile_x);
+		unsigned int first_row = thickness_rows.find(tile_y);
+		unsigned int last_col = std::min<unsigned int>(thickness_cols.find(tile_x + tile_size - 1), get_col_count()-1);
+		unsigned int last_row = std::min<unsigned int>(thickness_rows.find(tile_y + tile_size - 1), get_row_count()-1);
+
+		// positions of the columns and rows in the tile, and of their ends
+		std::vector<int> col_x = {(int)(thickness_cols.sum(first_col) - tile_x)};
+		for (unsigned int i=first_col ; i<=last_col ; ++i)
+			col_x.push_back(col_x.back() + thickness_cols[i]);
+		std::vector<int> row_y = {(int)(thickness_rows.sum(first_row) - tile_y)};
+		for (unsigned int i=first_row ; i<=last_row ; ++i)
+			row_y.push_back(row_y.back() + thickness_rows[i]);
+
+		// backgrounds first, one call by color, then the texts, queued together and drawn in a few calls
+		std::vector<typename selection_t::cell_state_t> states;
+		selection.get_cell_states(CellRect({first_col, first_row}, {last_col, last_row}), states);
+		std::vector<SDL_Rect> backgrounds[3];
+		for (unsigned int row_idx=first_row ; row_idx<=last_row ; ++row_idx)
+			for (unsigned int col_idx=first_col ; col_idx<=last_col ; ++col_idx)
+			{
+				auto state = states[(row_idx-first_row) * (last_col-first_col+1) + col_idx-first_col];
+				backgrounds[(int)state].push_back(SDL_Rect{col_x[col_idx-first_col], row_y[row_idx-first_row], (int)thickness_cols[col_idx]-1, (int)thickness_rows[row_idx]-1});
+			}
+		tile.fill_rects(backgrounds[(int)selection_t::cell_state_t::none], color_cell_bg.r, color_cell_bg.g, color_cell_bg.b, color_cell_bg.a);
+		tile.fill_rects(backgrounds[(int)selection_t::cell_state_t::selected], selected_cells_overlay.r, selected_cells_overlay.g, selected_cells_overlay.b, selected_cells_overlay.a);
+		tile.fill_rects(backgrounds[(int)selection_t::cell_state_t::unselected], unselected_cells_overlay.r, unselected_cells_overlay.g, unselected_cells_overlay.b, unselected_cells_overlay.a);
+		// calculating marks, in the top right corners of the pending cells
+		std::vector<SDL_Rect> pending_marks;
+		for (unsigned int row_idx=first_row ; row_idx<=last_row ; ++row_idx)
+			for (unsigned int col_idx=first_col ; col_idx<=last_col ; ++col_idx)
+			{
+				CellData * cell = get_cell_at(col_idx, row_idx);
+				if ( ! cell || cell->formula.length() == 0)
+					continue;
+				int x = col_x[col_idx-first_col];
+				int y = row_y[row_idx-first_row];
+				int thickness_col = thickness_cols[col_idx];
+				int thickness_row = thickness_rows[row_idx];
+				if (cell->pending)
+					pending_marks.push_back(SDL_Rect{x + thickness_col - 6, y + 1, 4, 4});
+				if (cell->error)
+					tile.copy_from_text_to_rect_center(error_display, x, y, thickness_col-1, thickness_row-1);
+				else if (cell->get_horizontal_alignment() == horizontal_policy::alignment_t::center)
+					tile.copy_from_text_to_rect_center(cell_texts.get(cell->display), x, y, thickness_col-1, thickness_row-1);
+				else if (cell->get_horizontal_alignment() == horizontal_policy::alignment_t::left)
+					tile.copy_from_text_to_rect_left(cell_texts.get(cell->display), x, y, thickness_col-1, thickness_row-1);
+				else if (cell->get_horizontal_alignment() == horizontal_policy::alignment_t::right)
+					tile.copy_from_text_to_rect_right(cell_texts.get(cell->display), x, y, thickness_col-1, thickness_row-1);
+			}
+		tile.fill_rects(pending_marks, color_pending.r, color_pending.g, color_pending.b, color_pending.a);
+	}
+	DrawableArea & get_tile(long long tx, long long ty)
+	{
+		auto & tile = tiles[((unsigned long long)tx << 32) | (unsigned long long)ty];
+		if ( ! tile.area)
 		{
-			x = header_rows_width;
-			unsigned int col_idx = 0;
-			int next_y = y + thickness_row;
-			for (int thickness_col : thickness_cols)
+			if (free_tile_areas.empty())
 			{
-				int next_x = x + thickness_col;
-
-				color_t cell_color = get_cell_color_bg(col_idx, row_idx);
-				this->drawable_area.fill_rect(x, y, thickness_col-1, thickness_row-1, cell_color.r, cell_color.g, cell_color.b, cell_color.a);
-
-				if (cell_data[row_idx][col_idx].formula.length() > 0)
-				{
-					if (cell_data[row_idx][col_idx].error)
-						this->drawable_area.copy_from_text_to_rect_center(error_display, x, y, thickness_col-1, thickness_row-1);
-					else if (cell_data[row_idx][col_idx].get_horizontal_alignment() == horizontal_policy::alignment_t::center)
-						this->drawable_area.copy_from_text_to_rect_center(cell_data[row_idx][col_idx].display, x, y, thickness_col-1, thickness_row-1);
-					else if (cell_data[row_idx][col_idx].get_horizontal_alignment() == horizontal_policy::alignment_t::left)
-						this->drawable_area.copy_from_text_to_rect_left(cell_data[row_idx][col_idx].display, x, y, thickness_col-1, thickness_row-1);
-					else if (cell_data[row_idx][col_idx].get_horizontal_alignment() == horizontal_policy::alignment_t::right)
-						this->drawable_area.copy_from_text_to_rect_right(cell_data[row_idx][col_idx].display, x, y, thickness_col-1, thickness_row-1);
-				}
-
-				if (active_cell.x == col_idx && active_cell.y == row_idx)
-				{
-					this->drawable_area.draw_rect(x, y, thickness_col-1, thickness_row-1, color_active_cell.r, color_active_cell.g, color_active_cell.b, color_active_cell.a);
-					//this->drawable_area.draw_rect(x-1, y-1, thickness_col+1, thickness_row+1, color_active_cell.r, color_active_cell.g, color_active_cell.b, color_active_cell.a);
-				}
-				else if (edit_mode && edit_mode_select_cell && edit_mode_selected_cell.x == col_idx && edit_mode_selected_cell.y == row_idx)
-				{
-					this->drawable_area.draw_rect(x, y, thickness_col-1, thickness_row-1, color_active_cell.r, color_edit_mode_selected_cell.g, color_edit_mode_selected_cell.b, color_edit_mode_selected_cell.a);
-				}
-
-				if (x > draw_width)
-					break;
-				x = next_x;
-				++col_idx;
+				tile.area = std::make_unique<DrawableArea>(parent_window, tile_size, tile_size, true);
+				tile.area->set_blending(false);
 			}
-			if (y > draw_height)
+			else
+			{
+				tile.area = std::move(free_tile_areas.back());
+				free_tile_areas.pop_back();
+			}
+			tile.valid = false;
+		}
+		if ( ! tile.valid)
+		{
+			render_tile(*tile.area, tx, ty);
+			tile.valid = true;
+		}
+		tile.last_used = frame_count;
+		return *tile.area;
+	}
+	// the tiles least recently drawn give their texture back, for other tiles to reuse
+	void evict_tiles()
+	{
+		if (tiles.size() <= max_tiles)
+			return;
+		std::vector<std::pair<unsigned long long, unsigned long long>> by_use; // last use, key
+		for (const auto & [key, tile] : tiles)
+			if (tile.last_used != frame_count)
+				by_use.push_back({tile.last_used, key});
+		std::sort(std::begin(by_use), std::end(by_use));
+		for (const auto & [last_used, key] : by_use)
+		{
+			if (tiles.size() <= max_tiles)
 				break;
-			y = next_y;
-			++row_idx;
+			free_tile_areas.push_back(std::move(tiles[key].area));
+			tiles.erase(key);
+		}
+	}
+	// tiles crossing the sheet rect, in pixels, are rendered again when next drawn
+	void invalidate_tiles(long long x0, long long y0, long long x1, long long y1)
+	{
+		// a few tiles, for a cell: looked up rather than all visited
+		if (0 <= x0 && x0 < x1 && 0 <= y0 && y0 < y1 && (x1-1)/tile_size - x0/tile_size < 4 && (y1-1)/tile_size - y0/tile_size < 4)
+		{
+			for (long long tx=x0/tile_size ; tx<=(x1-1)/tile_size ; ++tx)
+				for (long long ty=y0/tile_size ; ty<=(y1-1)/tile_size ; ++ty)
+				{
+					auto it = tiles.find(((unsigned long long)tx << 32) | (unsigned long long)ty);
+					if (it != tiles.end())
+						it->second.valid = false;
+				}
+			return;
+		}
+		for (auto & [key, tile] : tiles)
+		{
+			long long tx = key >> 32;
+			long long ty = key & 0xffffffff;
+			if (tx * tile_size < x1 && x0 < (tx+1) * tile_size && ty * tile_size < y1 && y0 < (ty+1) * tile_size)
+				tile.valid = false;
 		}
+	}
+	void invalidate_all_tiles()
+	{
+		for (auto & [key, tile] : tiles)
+			tile.valid = false;
+	}
+	// the cell's content or look changed
+	virtual void invalidate_cell(unsigned int col_idx, unsigned int row_idx) override
+	{
+		invalidate_tiles(thickness_cols.sum(col_idx), thickness_rows.sum(row_idx), thickness_cols.sum(col_idx+1), thickness_rows.sum(row_idx+1));
+		damage_cell(col_idx, row_idx);
+	}
+	// what's right of the column, or under the row, moves
+	void set_col_thickness(unsigned int col_idx, unsigned int thickness)
+	{
+		thickness_cols.set(col_idx, thickness);
+		invalidate_tiles(thickness_cols.sum(col_idx), 0, std::numeric_limits<long long>::max(), std::numeric_limits<long long>::max());
+		this->set_needs_redraw();
+	}
+	void set_row_thickness(unsigned int row_idx, unsigned int thickness)
+	{
+		thickness_rows.set(row_idx, thickness);
+		invalidate_tiles(0, thickness_rows.sum(row_idx), std::numeric_limits<long long>::max(), std::numeric_limits<long long>::max());
+		this->set_needs_redraw();
+	}
 
-		this->draw_border();
+	// area of a visible cell, empty if it's scrolled out
+	Rect get_cell_rect(unsigned int col_idx, unsigned int row_idx) const
+	{
+		if (col_idx < scroll_col || row_idx < scroll_row || col_idx >= get_col_count() || row_idx >= get_row_count())
+			return Rect{0, 0, 0, 0};
+		int x = header_rows_width + thickness_cols.sum(col_idx) - thickness_cols.sum(scroll_col);
+		int y = header_cols_height + thickness_rows.sum(row_idx) - thickness_rows.sum(scroll_row);
+		return Rect{x, y, (int)thickness_cols[col_idx], (int)thickness_rows[row_idx]};
+	}
+	void damage_cell(unsigned int col_idx, unsigned int row_idx)
+	{
+		this->add_damage(get_cell_rect(col_idx, row_idx));
+	}
+	// the cell, and its headers, which show where the active cell and the selection are
+	void damage_cell_and_headers(unsigned int col_idx, unsigned int row_idx)
+	{
+		Rect r = get_cell_rect(col_idx, row_idx);
+		this->add_damage(r);
+		this->add_damage(Rect{r.x, 0, r.w, (int)header_cols_height});
+		this->add_damage(Rect{0, r.y, (int)header_rows_width, r.h});
 	}
 
 	color_t get_cell_color_bg(unsigned int col_idx, unsigned int row_idx)
@@ -724,88 +2110,14 @@ struct Grid : T::Widget
 	{
 		if (x < (int)header_rows_width)
 			return -1;
-		int result = 0;
-		int total_thickness = header_rows_width;
-		for (auto & thickness : thickness_cols)
-		{
-			total_thickness += thickness;
-			if (x < total_thickness)
-				break;
-			++result;
-		}
-		return result;
+		return thickness_cols.find(thickness_cols.sum(scroll_col) + x - header_rows_width);
 	}
 	// returns -1 for header
 	int get_row_at(int y) const
 	{
 		if (y < (int)header_cols_height)
 			return -1;
-		int result = 0;
-		int total_thickness = header_cols_height;
-		for (auto & thickness : thickness_rows)
-		{
-			total_thickness += thickness;
-			if (y < total_thickness)
-				break;
-			++result;
-		}
-		return result;
-	}
-
-	bool type_is_text(const std::string & type)
-	{
-		return type == "str";
-	}
-	bool type_is_number(const std::string & type)
-	{
-		return false
-			|| type == "int"
-			|| type == "float"
-			|| type == "complex"
-			;
-	}
-	bool type_is_date(const std::string & type)
-	{
-		return false
-			;
-	}
-	bool type_is_bool(const std::string & type)
-	{
-		return type == "bool";
-	}
-	bool type_is_list(const std::string & type)
-	{
-		return false
-			|| type == "list"
-			|| type == "tuple"
-			|| type == "set"
-			|| type == "dict"
-			|| type == "range"
-			|| type == "frozenset"
-			;
-	}
-	bool type_is_binary(const std::string & type)
-	{
-		return false
-			|| type == "bytes"
-			|| type == "bytearray"
-			|| type == "memoryview"
-			;
-	}
-	horizontal_policy::alignment_t get_horizontal_alignment(const std::string & type)
-	{
-		// TODO: make it a configuration file
-		if (type_is_text(type))
-			return horizontal_policy::alignment_t::left;
-		if (type_is_number(type))
-			return horizontal_policy::alignment_t::right;
-		if (type_is_date(type))
-			return horizontal_policy::alignment_t::center;
-		if (type_is_bool(type))
-			return horizontal_policy::alignment_t::center;
-		if (type_is_binary(type))
-			return horizontal_policy::alignment_t::left;
-		return horizontal_policy::alignment_t::center;
+		return thickness_rows.find(thickness_rows.sum(scroll_row) + y - header_cols_height);
 	}
 
 	// returns -2 if none, -1 if header, idx otherwise
@@ -814,19 +2126,14 @@ struct Grid : T::Widget
 		if (mouse_x <= (int)header_rows_width + header_resizing_area_thickness)
 		{
 			// might be on a row's edge in row header
-			int y = header_cols_height;
-			int i = -1;
-			for (int thickness : thickness_rows)
-			{
-				int next_y = y + thickness;
-				if (   mouse_y >= y - header_resizing_area_thickness
-					&& mouse_y <= y + header_resizing_area_thickness)
-					return i;
-				if (y >= this->rect.h)
-					break;
-				y = next_y;
-				++i;
-			}
+			// edge the closest before mouse_y+header_resizing_area_thickness
+			if (mouse_y < (int)header_cols_height - header_resizing_area_thickness)
+				return -2;
+			long long offset = thickness_rows.sum(scroll_row) + mouse_y - (int)header_cols_height;
+			unsigned int edge = std::max<unsigned int>(scroll_row, thickness_rows.find(offset + header_resizing_area_thickness));
+			if ((long long)thickness_rows.sum(edge) >= offset - header_resizing_area_thickness)
+				// the first edge is the header's
+				return edge == scroll_row ? -1 : edge-1;
 		}
 		return -2;
 	}
@@ -836,55 +2143,18 @@ struct Grid : T::Widget
 		if (mouse_y < (int)header_cols_height + header_resizing_area_thickness)
 		{
 			// might be on a row's edge in row header
-			int x = header_rows_width;
-			int i = -1;
-			for (int thickness : thickness_cols)
-			{
-				int next_x = x + thickness;
-				if (   mouse_x >= x - header_resizing_area_thickness
-					&& mouse_x <= x + header_resizing_area_thickness)
-					return i;
-				if (x >= this->rect.w)
-					break;
-				x = next_x;
-				++i;
-			}
+			// edge the closest before mouse_x+header_resizing_area_thickness
+			if (mouse_x < (int)header_rows_width - header_resizing_area_thickness)
+				return -2;
+			long long offset = thickness_cols.sum(scroll_col) + mouse_x - (int)header_rows_width;
+			unsigned int edge = std::max<unsigned int>(scroll_col, thickness_cols.find(offset + header_resizing_area_thickness));
+			if ((long long)thickness_cols.sum(edge) >= offset - header_resizing_area_thickness)
+				// the first edge is the header's
+				return edge == scroll_col ? -1 : edge-1;
 		}
 		return -2;
 	}
 
-	CellData * get_cell_at(unsigned int col_idx, unsigned int row_idx)
-	{
-		if (row_idx >= cell_data.size() || col_idx >= cell_data[row_idx].size())
-			return nullptr;
-		return &cell_data[row_idx][col_idx];
-	}
-	icu::UnicodeString get_formula_at(unsigned int col_idx, unsigned int row_idx)
-	{
-		if (row_idx >= cell_data.size() || col_idx >= cell_data[row_idx].size())
-			return "";
-		return cell_data[row_idx][col_idx].formula;
-	}
-	void set_formula_at(unsigned int col_idx, unsigned int row_idx, icu::UnicodeString text)
-	{
-		if (row_idx >= cell_data.size() || col_idx >= cell_data[row_idx].size())
-			return;
-		if (cell_data[row_idx][col_idx].set_formula(text, col_idx, row_idx))
-			this->set_needs_redraw();
-	}
-	icu::UnicodeString get_value_at(unsigned int col_idx, unsigned int row_idx)
-	{
-		if (row_idx >= cell_data.size() || col_idx >= cell_data[row_idx].size())
-			return "";
-		return cell_data[row_idx][col_idx].display.get_text();
-	}
-	std::string get_type_at(unsigned int col_idx, unsigned int row_idx)
-	{
-		if (row_idx >= cell_data.size() || col_idx >= cell_data[row_idx].size())
-			return "";
-		return cell_data[row_idx][col_idx].type;
-	}
-
 	void set_active_cell(unsigned int col_idx, unsigned int row_idx)
 	{
 		set_formula_at(active_cell.x, active_cell.y, editor.get_text());
@@ -893,17 +2163,11 @@ struct Grid : T::Widget
 		if (active_cell != p)
 		{
 			editor.set_text(get_formula_at(col_idx, row_idx));
+			damage_cell_and_headers(active_cell.x, active_cell.y);
 			active_cell = p;
+			damage_cell_and_headers(active_cell.x, active_cell.y);
 		}
-	}
-
-	unsigned int get_col_count() const
-	{
-		return thickness_cols.size();
-	}
-	unsigned int get_row_count() const
-	{
-		return thickness_rows.size();
+		scroll_to_cell(col_idx, row_idx);
 	}
 
 	void insert_or_replace_cell_name(unsigned col_idx, unsigned row_idx)
@@ -930,28 +2194,41 @@ struct Grid : T::Widget
 		return formula;
 	}
 
+	// The written or referenced cells that are selected, in no particular order. A whole selected
+	// column or sheet costs as much as its cells, not its area.
+	std::vector<CellCoords> get_selected_cells(const selection_t & sel)
+	{
+		std::vector<CellCoords> result;
+		cell_data.for_each([&](unsigned int col_idx, unsigned int row_idx, CellData &)
+			{
+				if (col_idx < get_col_count() && row_idx < get_row_count() && sel.is_cell_selected(col_idx, row_idx))
+					result.push_back(CellCoords{col_idx, row_idx});
+			});
+		return result;
+	}
+
 	void paste(const selection_t & sel, unsigned int new_x, unsigned int new_y)
 	{
 		int offset_x = new_x - sel.reference_cell.x;
 		int offset_y = new_y - sel.reference_cell.y;
 
-		for (const auto & p : sel.selected_cells)
+		// every formula read before any is written, the copied cells and their destination may overlap
+		std::vector<std::pair<CellCoords, icu::UnicodeString>> edits;
+		for (const auto & p : get_selected_cells(sel))
 		{
-			CellData * cell_data = get_cell_at(p.x, p.y);
-			assert(cell_data);
-			if ( ! cell_data)
-				continue;
-			if (p.x+offset_x < 0)
+			if ((int)p.x+offset_x < 0)
 				// TODO: error message
 				continue;
-			if (p.y+offset_y < 0)
+			if ((int)p.y+offset_y < 0)
 				// TODO: error message
 				continue;
-			auto new_formula = translate_formula(cell_data->formula, offset_x, offset_y);
-			set_formula_at(p.x+offset_x, p.y+offset_y, new_formula);
-			if (p == sel.reference_cell)
-				editor.set_text(new_formula);
+			auto new_formula = translate_formula(get_formula_at(p.x, p.y), offset_x, offset_y);
+			edits.push_back({CellCoords{p.x+offset_x, p.y+offset_y}, new_formula});
 		}
+		// the reference cell may never have been written
+		if (sel.is_cell_selected(sel.reference_cell.x, sel.reference_cell.y))
+			editor.set_text(translate_formula(get_formula_at(sel.reference_cell.x, sel.reference_cell.y), offset_x, offset_y));
+		set_formulas(edits);
 	}
 
 	virtual bool handle_event(event & ev) override
@@ -962,6 +2239,13 @@ struct Grid : T::Widget
 				return true;
 			case window_shown:
 				return false;
+			case mouse_wheel:
+				// shift+wheel scrolls horizontally
+				if (key_shift)
+					scroll_by(-ev.data.mouse_wheel.scroll_y*wheel_scroll_lines, 0);
+				else
+					scroll_by(ev.data.mouse_wheel.scroll_x*wheel_scroll_lines, -ev.data.mouse_wheel.scroll_y*wheel_scroll_lines);
+				return true;
 			case mouse:
 			{
 				int row_edge_idx = is_mouse_on_row_header_edge(ev.data.mouse.x, ev.data.mouse.y);
@@ -986,11 +2270,12 @@ struct Grid : T::Widget
 
 				if (edit_mode)
 				{
+					damage_cell(edit_mode_selected_cell.x, edit_mode_selected_cell.y);
 					edit_mode_select_cell = true;
 					edit_mode_selected_cell.x = col_idx;
 					edit_mode_selected_cell.y = row_idx;
+					damage_cell(edit_mode_selected_cell.x, edit_mode_selected_cell.y);
 					insert_or_replace_cell_name(col_idx, row_idx);
-					this->set_needs_redraw();
 					break;
 				}
 
@@ -1035,8 +2320,7 @@ struct Grid : T::Widget
 							unsigned int new_thickness = (unsigned int)std::max(1, (int)row_thickness + drag_y - grab_y);
 							if (this->thickness_rows[row_edge_idx] != new_thickness)
 							{
-								this->thickness_rows[row_edge_idx] = new_thickness;
-								this->set_needs_redraw();
+								this->set_row_thickness(row_edge_idx, new_thickness);
 							}
 						},
 						[row_edge_idx,this,row_thickness](T::Widget*, [[maybe_unused]]int grab_x, [[maybe_unused]]int grab_y, [[maybe_unused]]int ungrab_x, [[maybe_unused]]int ungrab_y)
@@ -1045,8 +2329,7 @@ struct Grid : T::Widget
 							unsigned int new_thickness = (unsigned int)std::max(1, (int)row_thickness + ungrab_y - grab_y);
 							if (this->thickness_rows[row_edge_idx] != new_thickness)
 							{
-								this->thickness_rows[row_edge_idx] = new_thickness;
-								this->set_needs_redraw();
+								this->set_row_thickness(row_edge_idx, new_thickness);
 							}
 						});
 					break;
@@ -1087,8 +2370,7 @@ struct Grid : T::Widget
 							unsigned int new_thickness = (unsigned int) std::max(1, (int)col_thickness + drag_x - grab_x);
 							if (this->thickness_cols[col_edge_idx] != new_thickness)
 							{
-								this->thickness_cols[col_edge_idx] = new_thickness;
-								this->set_needs_redraw();
+								this->set_col_thickness(col_edge_idx, new_thickness);
 							}
 						},
 						[col_edge_idx,this,col_thickness](T::Widget*, [[maybe_unused]]int grab_x, [[maybe_unused]]int grab_y, [[maybe_unused]]int ungrab_x, [[maybe_unused]]int ungrab_y)
@@ -1096,18 +2378,20 @@ struct Grid : T::Widget
 							unsigned int new_thickness = (unsigned int) std::max(1, (int)col_thickness + ungrab_x - grab_x);
 							if (this->thickness_cols[col_edge_idx] != new_thickness)
 							{
-								this->thickness_cols[col_edge_idx] = new_thickness;
-								this->set_needs_redraw();
+								this->set_col_thickness(col_edge_idx, new_thickness);
 							}
 							this->parent_window->set_cursor(MouseCursorImg::ARROW);
 						});
 					break;
 				}
 
+				// changes to the selection redraw the whole grid, the active cell damages itself
 				bool changed = false;
+				bool cells_damaged_only = false;
 				if ( ! key_ctrl)
 				{
 					// if ctrl, keep previous selection, wipe otherwise
+					changed |= ! selection.empty() || ! selection.selected_cells.empty();
 					selection.clear();
 				}
 				if (key_shift)
@@ -1173,9 +2457,14 @@ struct Grid : T::Widget
 						if (active_cell != old_active_cell && selection.empty())
 						{
 							selection.toggle_selected_cell(old_active_cell.x, old_active_cell.y);
+							invalidate_cell(old_active_cell.x, old_active_cell.y);
+							damage_cell_and_headers(old_active_cell.x, old_active_cell.y);
 						}
-						changed |= true;
 						selection.toggle_selected_cell(col_idx, row_idx);
+						invalidate_cell(col_idx, row_idx);
+						damage_cell_and_headers(col_idx, row_idx);
+						changed |= true;
+						cells_damaged_only = true;
 					}
 				}
 				else
@@ -1204,8 +2493,11 @@ struct Grid : T::Widget
 						}
 					}
 				}
-				if (changed)
+				if (changed && ! cells_damaged_only)
+				{
+					invalidate_all_tiles();
 					this->set_needs_redraw();
+				}
 				return changed;
 			}
 			case key:
@@ -1244,6 +2536,8 @@ struct Grid : T::Widget
 				}
 				if ( ! ev.data.key.pressed)
 					break;
+				// the active cell and the edited cells damage themselves, only the cell selected while editing is left
+				auto old_selected_cell = edit_mode_selected_cell;
 				bool changed = false;
 				switch (ev.data.key.keycode)
 				{
@@ -1258,6 +2552,7 @@ struct Grid : T::Widget
 								changed |= true;
 							}
 							insert_or_replace_cell_name(edit_mode_selected_cell.x, edit_mode_selected_cell.y);
+							scroll_to_cell(edit_mode_selected_cell.x, edit_mode_selected_cell.y);
 						}
 						else
 						{
@@ -1277,6 +2572,7 @@ struct Grid : T::Widget
 								changed |= true;
 							}
 							insert_or_replace_cell_name(edit_mode_selected_cell.x, edit_mode_selected_cell.y);
+							scroll_to_cell(edit_mode_selected_cell.x, edit_mode_selected_cell.y);
 						}
 						else
 						{
@@ -1298,6 +2594,7 @@ struct Grid : T::Widget
 								changed |= true;
 							}
 							insert_or_replace_cell_name(edit_mode_selected_cell.x, edit_mode_selected_cell.y);
+							scroll_to_cell(edit_mode_selected_cell.x, edit_mode_selected_cell.y);
 						}
 						else
 						{
@@ -1317,6 +2614,7 @@ struct Grid : T::Widget
 								changed |= true;
 							}
 							insert_or_replace_cell_name(edit_mode_selected_cell.x, edit_mode_selected_cell.y);
+							scroll_to_cell(edit_mode_selected_cell.x, edit_mode_selected_cell.y);
 						}
 						else
 						{
@@ -1357,6 +2655,16 @@ struct Grid : T::Widget
 						edit_mode = false;
 						editor.take_focus();
 						break;
+					case Scancode::F12:
+						// starts profiling, or stops it writing its report
+						if (profiler.enabled)
+						{
+							if (write_profile_report(profile_report_filename))
+								std::cout << "Profile written to " << profile_report_filename << std::endl;
+							profiler.clear();
+						}
+						profiler.enabled = ! profiler.enabled;
+						break;
 					case Scancode::Delete:
 						if (edit_mode)
 						{
@@ -1373,7 +2681,10 @@ struct Grid : T::Widget
 						else
 						{
 							editor.clear();
-							set_formula_at(active_cell.x, active_cell.y, "");
+							std::vector<std::pair<CellCoords, icu::UnicodeString>> edits = {{active_cell, ""}};
+							for (const auto & p : get_selected_cells(selection))
+								edits.push_back({p, ""});
+							set_formulas(edits);
 							changed |= true;
 						}
 						break;
@@ -1402,7 +2713,10 @@ struct Grid : T::Widget
 						editor.handle_event(ev);
 				}
 				if (changed)
-					this->set_needs_redraw();
+				{
+					damage_cell(old_selected_cell.x, old_selected_cell.y);
+					damage_cell(edit_mode_selected_cell.x, edit_mode_selected_cell.y);
+				}
 				return changed;
 			}
 			case text:
@@ -1416,11 +2730,11 @@ struct Grid : T::Widget
 				{
 					if (edit_mode_select_cell)
 					{
+						damage_cell(edit_mode_selected_cell.x, edit_mode_selected_cell.y);
 						edit_mode_select_cell = false;
 						edit_mode_selected_cell = active_cell;
 						insert_or_replace_cell_name_idx = -1;
 						insert_or_replace_cell_name_len = -1;
-						this->set_needs_redraw();
 					}
 				}
 				editor.handle_event(ev);
@@ -1432,7 +2746,7 @@ struct Grid : T::Widget
 	}
 };
 
-inline static Grid<OW<SDL>> * global_grid;
+inline static GridBase * global_grid;
 
 /*
 PYBIND11_EMBEDDED_MODULE(ourcalc_cell, m) {
@@ -1446,110 +2760,751 @@ PYBIND11_EMBEDDED_MODULE(ourcalc_cell, m) {
 		return global_grid->get_type_at(c, r);
 	});
 }
-*/
-
-unsigned int parse_col_name(std::string col_name)
+*/
+
+unsigned int parse_col_name(std::string col_name)
+{
+	if (col_name.size() == 0)
+		throw std::exception();
+	unsigned int result = col_name[0] - 'A';
+	for(unsigned int i=1 ; i<col_name.size() ; ++i)
+	{
+		result = (result + 1)*26;
+		result += col_name[i] - 'A';
+	}
+	return result;
+}
+
+std::string get_cell_name_string(unsigned col_idx, unsigned row_idx)
+{
+	return column_name_from_int(col_idx).append(std::to_string(row_idx));
+}
+icu::UnicodeString get_cell_name_utf8(unsigned col_idx, unsigned row_idx)
+{
+	return icu::UnicodeString::fromUTF8(get_cell_name_string(col_idx, row_idx));
+}
+
+std::string column_name_from_int(int c)
+{
+	int remainder = c % 26;
+	c /= 26;
+	std::string result(1, 'A'+remainder);
+	while (c != 0)
+	{
+		--c;
+		remainder = c % 26;
+		c /= 26;
+		result.push_back('A'+remainder);
+	}
+	std::reverse(result.begin(), result.end());
+	return result;
+}
+
+bool is_identifier_char(char16_t c)
+{
+	return c == '_'
+	    || (c >= 'a' && c <= 'z')
+	    || (c >= 'A' && c <= 'Z')
+	    || (c >= '0' && c <= '9')
+	    || c > 127
+	    ;
+}
+
+// Parses A1, _A1, A_1 or _A_1 in code[start,end[
+bool parse_cell_name(const icu::UnicodeString & code, int32_t start, int32_t end, CellCoords & result)
+{
+	int32_t i = start;
+	if (i < end && code[i] == '_')
+		++i;
+	int32_t col_start = i;
+	unsigned int col = 0;
+	for ( ; i < end && code[i] >= 'A' && code[i] <= 'Z' ; ++i)
+		col = (i == col_start) ? code[i] - 'A' : (col + 1)*26 + code[i] - 'A';
+	if (i == col_start || i - col_start > 6)
+		return false;
+	if (i < end && code[i] == '_')
+		++i;
+	int32_t row_start = i;
+	unsigned int row = 0;
+	for ( ; i < end && code[i] >= '0' && code[i] <= '9' ; ++i)
+		row = row*10 + code[i] - '0';
+	if (i != end || i == row_start || i - row_start > 9)
+		return false;
+	// A01 isn't a cell for python, see ourcells
+	if (i - row_start > 1 && code[row_start] == '0')
+		return false;
+	result = CellCoords{col, row};
+	return true;
+}
+
+struct CellReference
+{
+	CellRect rect; // 1x1 for a single cell
+	bool is_range;
+	int32_t start; // position in the formula
+	int32_t length;
+};
+
+int32_t scan_python_code(const icu::UnicodeString & code, int32_t i, bool in_fstring, std::vector<CellReference> & result);
+
+bool is_string_prefix(const icu::UnicodeString & code, int32_t start, int32_t end)
+{
+	if (end - start > 2)
+		return false;
+	for (int32_t i=start ; i<end ; ++i)
+		switch (code[i])
+		{
+			case 'r': case 'R': case 'b': case 'B': case 'u': case 'U': case 'f': case 'F':
+				break;
+			default:
+				return false;
+		}
+	return true;
+}
+
+// Skips the string literal whose opening quote is at i, looking for cell references
+// in the replacement fields of f-strings.
+// Returns the position just after the closing quote.
+int32_t scan_string_literal(const icu::UnicodeString & code, int32_t i, bool is_fstring, std::vector<CellReference> & result)
+{
+	int32_t len = code.length();
+	char16_t quote = code[i];
+	bool triple = i+2 < len && code[i+1] == quote && code[i+2] == quote;
+	i += triple ? 3 : 1;
+	while (i < len)
+	{
+		char16_t c = code[i];
+		if (c == '\\')
+			i += 2;
+		else if (c == quote && ( ! triple || (i+2 < len && code[i+1] == quote && code[i+2] == quote)))
+			return i + (triple ? 3 : 1);
+		else if (is_fstring && c == '{' && i+1 < len && code[i+1] == '{')
+			i += 2;
+		else if (is_fstring && c == '{')
+			i = scan_python_code(code, i+1, true, result);
+		else
+			++i;
+	}
+	return len;
+}
+
+int32_t skip_spaces(const icu::UnicodeString & code, int32_t i)
+{
+	while (i < code.length() && (code[i] == ' ' || code[i] == '\t'))
+		++i;
+	return i;
+}
+
+// Looks for cell references (A1, _A1, A_1 or _A_1) and ranges (A1:B2) in
+// python code, skipping comments, string literals, numbers and attributes.
+// If in_fstring, stops after the '}' closing the f-string replacement field
+// and returns its position.
+int32_t scan_python_code(const icu::UnicodeString & code, int32_t i, bool in_fstring, std::vector<CellReference> & result)
+{
+	int32_t len = code.length();
+	std::vector<char16_t> brackets;
+	bool after_dot = false;
+	while (i < len)
+	{
+		char16_t c = code[i];
+		if (in_fstring && brackets.empty() && c == '}')
+			return i+1;
+		if (in_fstring && brackets.empty() && (c == ':' || (c == '!' && (i+1 == len || code[i+1] != '='))))
+		{
+			// format spec, may contain nested replacement fields
+			int depth = 0;
+			for ( ; i < len ; ++i)
+			{
+				if (code[i] == '{')
+					++depth;
+				else if (code[i] == '}' && depth-- == 0)
+					return i+1;
+			}
+			return len;
+		}
+
+		if (c == '#')
+		{
+			while (i < len && code[i] != '\n')
+				++i;
+		}
+		else if (c == '\'' || c == '"')
+		{
+			i = scan_string_literal(code, i, false, result);
+			after_dot = false;
+		}
+		else if ((c >= '0' && c <= '9') || (c == '.' && i+1 < len && code[i+1] >= '0' && code[i+1] <= '9'))
+		{
+			bool is_hex_like = c == '0' && i+1 < len && code[i+1] > '9';
+			for (++i ; i < len ; ++i)
+			{
+				if ((code[i] == '+' || code[i] == '-') && ! is_hex_like && (code[i-1] == 'e' || code[i-1] == 'E'))
+					continue;
+				if ( ! is_identifier_char(code[i]) && code[i] != '.')
+					break;
+			}
+			after_dot = false;
+		}
+		else if (is_identifier_char(c))
+		{
+			int32_t start = i;
+			while (i < len && is_identifier_char(code[i]))
+				++i;
+
+			if (i < len && (code[i] == '\'' || code[i] == '"') && is_string_prefix(code, start, i))
+			{
+				bool is_fstring = false;
+				for (int32_t j=start ; j<i ; ++j)
+					is_fstring |= code[j] == 'f' || code[j] == 'F';
+				i = scan_string_literal(code, i, is_fstring, result);
+				after_dot = false;
+				continue;
+			}
+
+			CellCoords p;
+			bool is_attribute = after_dot;
+			after_dot = false;
+			if (is_attribute || ! parse_cell_name(code, start, i, p))
+				continue;
+
+			int32_t j = skip_spaces(code, i);
+			bool in_parentheses = brackets.empty() || brackets.back() == '(';
+			if (j < len && code[j] == '=' && (j+1 == len || code[j+1] != '=') && ! brackets.empty() && brackets.back() == '(')
+				// keyword argument
+				continue;
+
+			if (j < len && code[j] == ':' && in_parentheses && ! (in_fstring && brackets.empty()))
+			{
+				int32_t k = skip_spaces(code, j+1);
+				int32_t end = k;
+				while (end < len && is_identifier_char(code[end]))
+					++end;
+				CellCoords q;
+				if (parse_cell_name(code, k, end, q))
+				{
+					result.push_back(CellReference{CellRect(p, q), true, start, end-start});
+					i = end;
+					continue;
+				}
+			}
+			result.push_back(CellReference{CellRect(p, p), false, start, i-start});
+		}
+		else
+		{
+			if (c == '(' || c == '[' || c == '{')
+				brackets.push_back(c);
+			else if ((c == ')' || c == ']' || c == '}') && ! brackets.empty())
+				brackets.pop_back();
+			if (c != ' ' && c != '\t' && c != '\n' && c != '\\')
+				after_dot = c == '.';
+			++i;
+		}
+	}
+	return len;
+}
+
+// Finds the cells a formula refers to, without involving the python interpreter.
+std::vector<CellReference> extract_cell_references(const icu::UnicodeString & formula, int32_t start = 0)
+{
+	std::vector<CellReference> result;
+	scan_python_code(formula, start, false, result);
+	return result;
+}
+
+// Python code for the formula's expression, ranges translated into lists.
+icu::UnicodeString get_python_expression(const icu::UnicodeString & formula, const std::vector<CellReference> & references)
+{
+	icu::UnicodeString result;
+	int32_t last = 1;
+	for (const auto & r : references)
+	{
+		if ( ! r.is_range)
+			continue;
+		result.append(formula, last, r.start - last);
+		result.append(icu::UnicodeString::fromUTF8(std::string("ourrange(locals(),")
+			.append(std::to_string(r.rect.upleft.x)).append(",")
+			.append(std::to_string(r.rect.upleft.y)).append(",")
+			.append(std::to_string(r.rect.downright.x)).append(",")
+			.append(std::to_string(r.rect.downright.y)).append(")")));
+		last = r.start + r.length;
+	}
+	result.append(formula, last, formula.length() - last);
+	return result;
+}
+
+// Same as python's repr(float)/str(float)
+std::string python_float_repr(double f)
+{
+	if (std::isnan(f))
+		return "nan";
+	if (std::isinf(f))
+		return f < 0 ? "-inf" : "inf";
+
+	// shortest digits that read back as the same double
+	char buffer[32];
+	for (int precision=0 ; precision<17 ; ++precision)
+	{
+		snprintf(buffer, sizeof(buffer), "%.*e", precision, f);
+		if (strtod(buffer, nullptr) == f)
+			break;
+	}
+
+	// split d.ddde[+-]xx into sign, digits and decimal point position
+	std::string result = std::signbit(f) ? "-" : "";
+	const char * p = buffer + (buffer[0] == '-');
+	std::string digits;
+	for ( ; *p != 'e' ; ++p)
+		if (*p != '.')
+			digits.push_back(*p);
+	int decimal_point = atoi(p+1) + 1;
+	while (digits.size() > 1 && digits.back() == '0')
+		digits.pop_back();
+
+	int n = digits.size();
+	if (decimal_point <= -4 || decimal_point > 16)
+	{
+		result.push_back(digits[0]);
+		if (n > 1)
+			result.append(".").append(digits, 1);
+		char exponent[8];
+		snprintf(exponent, sizeof(exponent), "e%+03d", decimal_point-1);
+		result.append(exponent);
+	}
+	else if (decimal_point <= 0)
+		result.append("0.").append(-decimal_point, '0').append(digits);
+	else if (decimal_point < n)
+		result.append(digits, 0, decimal_point).append(".").append(digits, decimal_point);
+	else
+		result.append(digits).append(decimal_point-n, '0').append(".0");
+	return result;
+}
+
+std::string native_value_to_string(const NativeValue & v)
+{
+	switch (v.type)
+	{
+		case NativeValue::type_t::boolean : return v.i ? "True" : "False";
+		case NativeValue::type_t::integer : return std::to_string(v.i);
+		case NativeValue::type_t::floating: return python_float_repr(v.f);
+		default: return "";
+	}
+}
+value_type_t native_value_type(const NativeValue & v)
+{
+	switch (v.type)
+	{
+		case NativeValue::type_t::boolean : return value_type_t::boolean;
+		case NativeValue::type_t::integer : return value_type_t::integer;
+		case NativeValue::type_t::floating: return value_type_t::floating;
+		default: return value_type_t::none;
+	}
+}
+// Kind of a python value, and the value itself if it is a number that fits a NativeValue.
+// bool is checked before int, it derives from it.
+value_type_t classify_python_value(PyObject * v, NativeValue & number)
 {
-	if (col_name.size() == 0)
-		throw std::exception();
-	unsigned int result = col_name[0] - 'A';
-	for(unsigned int i=1 ; i<col_name.size() ; ++i)
+	number = NativeValue();
+	if (PyBool_Check(v))
 	{
-		result = (result + 1)*26;
-		result += col_name[i] - 'A';
+		number.type = NativeValue::type_t::boolean;
+		number.i = v == Py_True;
+		return value_type_t::boolean;
+	}
+	if (PyLong_Check(v))
+	{
+		int overflow;
+		number.i = PyLong_AsLongLongAndOverflow(v, &overflow);
+		if (overflow == 0 && ! (number.i == -1 && PyErr_Occurred()))
+			number.type = NativeValue::type_t::integer;
+		PyErr_Clear();
+		return value_type_t::integer;
+	}
+	if (PyFloat_Check(v))
+	{
+		number.type = NativeValue::type_t::floating;
+		number.f = PyFloat_AS_DOUBLE(v);
+		return value_type_t::floating;
+	}
+	if (PyComplex_Check(v))
+		return value_type_t::complex;
+	if (PyUnicode_Check(v))
+		return value_type_t::text;
+	if (PyList_Check(v) || PyTuple_Check(v) || PyDict_Check(v) || PyAnySet_Check(v) || PyRange_Check(v))
+		return value_type_t::list;
+	if (PyBytes_Check(v) || PyByteArray_Check(v) || PyMemoryView_Check(v))
+		return value_type_t::binary;
+	return value_type_t::other;
+}
+py::object native_value_to_python(const NativeValue & v)
+{
+	switch (v.type)
+	{
+		case NativeValue::type_t::boolean : return py::bool_(v.i != 0);
+		case NativeValue::type_t::integer : return py::int_(v.i);
+		case NativeValue::type_t::floating: return py::float_(v.f);
+		default: return py::none();
 	}
-	return result;
 }
 
-std::tuple<unsigned int, unsigned int> parse_cell_name(const std::string & cell_name)
+// Compiles formulas made only of numbers, cell references, + - * / **,
+// comparisons and parentheses, following python's grammar.
+// Anything else makes the compilation fail, and the formula is left to python.
+struct NativeFormulaCompiler
 {
-	unsigned int col, row;
+	const icu::UnicodeString & code;
+	int32_t i;
+	std::vector<NativeOp> & ops;
 
-	int i = 0;
-	if (cell_name[i] == '_')
-		i = 1;
-	int start = i;
-	while (cell_name[i] >= 'A' && cell_name[i] <= 'Z')
-		++i;
-	col = parse_col_name(cell_name.substr(start, i));
-	if (cell_name[i] == '_')
-		++i;
-	row = std::stoi(cell_name.substr(i));
-	return {col, row};
+	void skip_spaces()
+	{
+		while (i < code.length() && (code[i] == ' ' || code[i] == '\t'))
+			++i;
+	}
+	bool next_is(const char * s)
+	{
+		skip_spaces();
+		int32_t j = i;
+		for ( ; *s ; ++s, ++j)
+			if (j >= code.length() || code[j] != *s)
+				return false;
+		return true;
+	}
+	bool accept(const char * s)
+	{
+		if ( ! next_is(s))
+			return false;
+		i += strlen(s);
+		return true;
+	}
+
+	bool compile()
+	{
+		if ( ! comparison())
+			return false;
+		skip_spaces();
+		return i == code.length();
+	}
+	// no chained comparisons
+	bool comparison()
+	{
+		if ( ! arith())
+			return false;
+		NativeOp::code_t op;
+		if      (accept("<=")) op = NativeOp::code_t::le;
+		else if (accept(">=")) op = NativeOp::code_t::ge;
+		else if (accept("==")) op = NativeOp::code_t::eq;
+		else if (accept("!=")) op = NativeOp::code_t::ne;
+		else if (next_is("<<") || next_is(">>")) return false;
+		else if (accept("<" )) op = NativeOp::code_t::lt;
+		else if (accept(">" )) op = NativeOp::code_t::gt;
+		else return true;
+		if ( ! arith())
+			return false;
+		ops.push_back(NativeOp{op});
+		return ! (next_is("<") || next_is(">") || next_is("==") || next_is("!="));
+	}
+	bool arith()
+	{
+		if ( ! term())
+			return false;
+		while (true)
+		{
+			NativeOp::code_t op;
+			if      (accept("+")) op = NativeOp::code_t::add;
+			else if (accept("-")) op = NativeOp::code_t::sub;
+			else return true;
+			if ( ! term())
+				return false;
+			ops.push_back(NativeOp{op});
+		}
+	}
+	bool term()
+	{
+		if ( ! factor())
+			return false;
+		while (true)
+		{
+			NativeOp::code_t op;
+			if (next_is("**") || next_is("//"))
+				return true;
+			else if (accept("*")) op = NativeOp::code_t::mul;
+			else if (accept("/")) op = NativeOp::code_t::div;
+			else return true;
+			if ( ! factor())
+				return false;
+			ops.push_back(NativeOp{op});
+		}
+	}
+	bool factor()
+	{
+		if (accept("-"))
+		{
+			if ( ! factor())
+				return false;
+			ops.push_back(NativeOp{NativeOp::code_t::negate});
+			return true;
+		}
+		if (accept("+"))
+		{
+			if ( ! factor())
+				return false;
+			ops.push_back(NativeOp{NativeOp::code_t::plus});
+			return true;
+		}
+		return power();
+	}
+	bool power()
+	{
+		if ( ! atom())
+			return false;
+		if ( ! accept("**"))
+			return true;
+		if ( ! factor())
+			return false;
+		ops.push_back(NativeOp{NativeOp::code_t::pow});
+		return true;
+	}
+	bool atom()
+	{
+		if (accept("("))
+			return comparison() && accept(")");
+		skip_spaces();
+		if (i >= code.length())
+			return false;
+		if ((code[i] >= '0' && code[i] <= '9') || code[i] == '.')
+			return number();
+		int32_t start = i;
+		while (i < code.length() && is_identifier_char(code[i]))
+			++i;
+		CellCoords p;
+		if ( ! parse_cell_name(code, start, i, p))
+			return false;
+		ops.push_back(NativeOp{NativeOp::code_t::cell, NativeValue(), p});
+		return true;
+	}
+	// digits, with python's optional underscores between them
+	int32_t digits()
+	{
+		int32_t start = i;
+		while (i < code.length() && code[i] >= '0' && code[i] <= '9')
+		{
+			++i;
+			if (i+1 < code.length() && code[i] == '_' && code[i+1] >= '0' && code[i+1] <= '9')
+				++i;
+		}
+		return i - start;
+	}
+	bool number()
+	{
+		int32_t start = i;
+		bool is_float = false;
+		int32_t integer_digits = digits();
+		if (i < code.length() && code[i] == '.')
+		{
+			is_float = true;
+			++i;
+			if (digits() == 0 && integer_digits == 0)
+				return false;
+		}
+		if (i < code.length() && (code[i] == 'e' || code[i] == 'E'))
+		{
+			is_float = true;
+			++i;
+			if (i < code.length() && (code[i] == '+' || code[i] == '-'))
+				++i;
+			if (digits() == 0)
+				return false;
+		}
+		// hexadecimal, imaginary...
+		if (i < code.length() && is_identifier_char(code[i]))
+			return false;
+
+		std::string text;
+		icu::UnicodeString(code, start, i-start).toUTF8String(text);
+		std::erase(text, '_');
+		NativeValue v;
+		errno = 0;
+		if (is_float)
+		{
+			v.type = NativeValue::type_t::floating;
+			v.f = strtod(text.c_str(), nullptr);
+		}
+		else
+		{
+			// python refuses leading zeros
+			if (text.size() > 1 && text[0] == '0' && text.find_first_not_of('0') != std::string::npos)
+				return false;
+			v.type = NativeValue::type_t::integer;
+			v.i = strtoll(text.c_str(), nullptr, 10);
+			if (errno != 0)
+				return false;
+		}
+		ops.push_back(NativeOp{NativeOp::code_t::constant, v});
+		return true;
+	}
+};
+
+// Returns an empty program if the formula needs python
+std::vector<NativeOp> compile_native_formula(const icu::UnicodeString & formula)
+{
+	std::vector<NativeOp> result;
+	NativeFormulaCompiler compiler{formula, 1, result};
+	if ( ! compiler.compile())
+		result.clear();
+	return result;
 }
 
-std::string get_cell_name_string(unsigned col_idx, unsigned row_idx)
+// integers above that might not convert exactly to double
+inline static const long long native_exact_double_limit = 1ll << 53;
+
+double native_value_to_double(const NativeValue & v)
 {
-	return column_name_from_int(col_idx).append(std::to_string(row_idx));
+	return v.type == NativeValue::type_t::floating ? v.f : (double)v.i;
 }
-icu::UnicodeString get_cell_name_utf8(unsigned col_idx, unsigned row_idx)
+bool is_exact_double(const NativeValue & v)
 {
-	return icu::UnicodeString::fromUTF8(get_cell_name_string(col_idx, row_idx));
+	return v.type == NativeValue::type_t::floating || (v.i <= native_exact_double_limit && v.i >= -native_exact_double_limit);
 }
 
-std::string column_name_from_int(int c)
+// Computes a op b like python would.
+// Returns false where python would raise, give a result of another type
+// (big integer, complex) or when the result could differ in any way.
+bool native_binary_op(NativeOp::code_t op, const NativeValue & a, const NativeValue & b, NativeValue & r)
 {
-	int remainder = c % 26;
-	c /= 26;
-	std::string result(1, 'A'+remainder);
-	while (c != 0)
+	bool integers = a.type != NativeValue::type_t::floating && b.type != NativeValue::type_t::floating;
+	double x = native_value_to_double(a);
+	double y = native_value_to_double(b);
+	switch (op)
 	{
-		--c;
-		remainder = c % 26;
-		c /= 26;
-		result.push_back('A'+remainder);
+		case NativeOp::code_t::add:
+		case NativeOp::code_t::sub:
+		case NativeOp::code_t::mul:
+			if (integers)
+			{
+				r.type = NativeValue::type_t::integer;
+				if (op == NativeOp::code_t::add) return ! __builtin_add_overflow(a.i, b.i, &r.i);
+				if (op == NativeOp::code_t::sub) return ! __builtin_sub_overflow(a.i, b.i, &r.i);
+				return ! __builtin_mul_overflow(a.i, b.i, &r.i);
+			}
+			r.type = NativeValue::type_t::floating;
+			r.f = op == NativeOp::code_t::add ? x + y
+			    : op == NativeOp::code_t::sub ? x - y
+			    :                               x * y;
+			return true;
+		case NativeOp::code_t::div:
+			// python divides integers exactly before rounding
+			if (y == 0 || ! is_exact_double(a) || ! is_exact_double(b))
+				return false;
+			r.type = NativeValue::type_t::floating;
+			r.f = x / y;
+			return true;
+		case NativeOp::code_t::pow:
+			if (integers && b.i >= 0)
+			{
+				r.type = NativeValue::type_t::integer;
+				r.i = 1;
+				long long base = a.i;
+				for (long long e = b.i ; e != 0 ; e >>= 1)
+				{
+					if ((e & 1) && __builtin_mul_overflow(r.i, base, &r.i))
+						return false;
+					if (e > 1 && __builtin_mul_overflow(base, base, &base))
+						return false;
+				}
+				return true;
+			}
+			// python raises on 0**-1 and overflows, returns complex numbers for (-1)**0.5
+			if ( ! std::isfinite(x) || ! std::isfinite(y) || (x == 0 && y < 0) || (x < 0 && y != std::floor(y)))
+				return false;
+			r.type = NativeValue::type_t::floating;
+			r.f = std::pow(x, y);
+			return std::isfinite(r.f);
+		default:
+			break;
 	}
-	std::reverse(result.begin(), result.end());
-	return result;
+
+	// comparisons
+	bool result;
+	if ( ! integers && ( ! is_exact_double(a) || ! is_exact_double(b)))
+		return false;
+	switch (op)
+	{
+		case NativeOp::code_t::lt: result = integers ? a.i <  b.i : x <  y; break;
+		case NativeOp::code_t::le: result = integers ? a.i <= b.i : x <= y; break;
+		case NativeOp::code_t::gt: result = integers ? a.i >  b.i : x >  y; break;
+		case NativeOp::code_t::ge: result = integers ? a.i >= b.i : x >= y; break;
+		case NativeOp::code_t::eq: result = integers ? a.i == b.i : x == y; break;
+		case NativeOp::code_t::ne: result = integers ? a.i != b.i : x != y; break;
+		default: return false;
+	}
+	r.type = NativeValue::type_t::boolean;
+	r.i = result;
+	return true;
 }
 
-icu::UnicodeString get_formula_python_code(icu::UnicodeString & formula, int col, int row)
+// get_cell_value(CellCoords, NativeValue &) returns false if the cell's value isn't a number.
+// Returns false if the formula has to be evaluated by python.
+template<typename F>
+bool evaluate_native_formula(const std::vector<NativeOp> & ops, F get_cell_value, NativeValue & result)
 {
-	icu::UnicodeString code = R"(
-result = _formula_
-_colname__row_.set_val(result)
+	std::vector<NativeValue> stack;
+	stack.reserve(ops.size());
+	for (const auto & op : ops)
+	{
+		switch (op.code)
+		{
+			case NativeOp::code_t::constant:
+				stack.push_back(op.value);
+				break;
+			case NativeOp::code_t::cell:
+				stack.emplace_back();
+				if ( ! get_cell_value(op.cell, stack.back()))
+					return false;
+				break;
+			case NativeOp::code_t::negate:
+				if (stack.back().type == NativeValue::type_t::floating)
+					stack.back().f = -stack.back().f;
+				else if (__builtin_sub_overflow(0ll, stack.back().i, &stack.back().i))
+					return false;
+				else
+					stack.back().type = NativeValue::type_t::integer;
+				break;
+			case NativeOp::code_t::plus:
+				if (stack.back().type == NativeValue::type_t::boolean)
+					stack.back().type = NativeValue::type_t::integer;
+				break;
+			default:
+			{
+				NativeValue b = stack.back();
+				stack.pop_back();
+				if ( ! native_binary_op(op.code, stack.back(), b, stack.back()))
+					return false;
+				break;
+			}
+		}
+	}
+	if (stack.size() != 1)
+		return false;
+	result = stack.back();
+	return true;
+}
 
-ourcalc_display_text = str(result)
-ourcalc_display_type = result.get_final_val().__class__.__name__ if is_ourcell(result) else result.__class__.__name__
-)";
+icu::UnicodeString get_formula_python_code(const icu::UnicodeString & expression, int col, int row)
+{
+	// an expression, its value given back by set_val. The formula on lines of its own, for comments.
+	icu::UnicodeString code = R"(_colname__row_.set_val((
+_formula_
+)))";
 
 	code.findAndReplace("_col_", icu::UnicodeString::fromUTF8(std::to_string(col)));
 	code.findAndReplace("_row_", icu::UnicodeString::fromUTF8(std::to_string(row)));
 	code.findAndReplace("_colname_"  , icu::UnicodeString::fromUTF8(column_name_from_int(col)));	
-	code.findAndReplace("_formula_"  , formula.tempSubString(1));
-	return code;
-}
-icu::UnicodeString get_parse_python_code(icu::UnicodeString & formula)
-{
-	icu::UnicodeString code = R"(
-import ast
-code = '_formula_'
-root = ast.parse(code)
-root = ast.walk(root)
-n = ast.Name
-var_set = set()
-for node in root:
-	if isinstance(node,n) and node.id in locals() and is_ourcell(locals()[str(node.id)]):
-		var_set.add(node.id)
-ourcalc_variables = ','.join(var_set)
-)";
-
-	//code.findAndReplace("_col_", icu::UnicodeString::fromUTF8(std::to_string(col)));
-	//code.findAndReplace("_row_", icu::UnicodeString::fromUTF8(std::to_string(row)));
-	//code.findAndReplace("_colname_"  , icu::UnicodeString::fromUTF8(column_name_from_int(col)));	
-	code.findAndReplace("_formula_"  , formula.tempSubString(1));
+	code.findAndReplace("_formula_"  , expression);
 	return code;
 }
 icu::UnicodeString get_string_python_code(icu::UnicodeString & formula, int col, int row)
 {
-	icu::UnicodeString code = R"(
-result = try_parse_text('''_formula_''')
-_colname__row_.set_val(result)
-
-ourcalc_display_text = str(result)
-ourcalc_display_type = result.get_final_val().__class__.__name__ if is_ourcell(result) else result.__class__.__name__
-ourcalc_variables = ""
-)";
+	icu::UnicodeString code = R"(_colname__row_.set_val(try_parse_text('''_formula_''')))";
 
 	code.findAndReplace("_col_", icu::UnicodeString::fromUTF8(std::to_string(col)));
 	code.findAndReplace("_row_", icu::UnicodeString::fromUTF8(std::to_string(row)));
@@ -1558,21 +3513,25 @@ ourcalc_variables = ""
 	return code;
 }
 
-std::vector<std::string> split(const std::string& s, const std::string& delimiter)
+py::object compile_python_code(const icu::UnicodeString & code)
 {
-	size_t last = 0;
-	size_t next = 0;
-	std::vector<std::string> result;
-	while ((next = s.find(delimiter, last)) != std::string::npos)
-	{
-		result.push_back(s.substr(last, next-last));
-		last = next + 1;
-	}
-	if (last != s.size())
-		result.push_back(s.substr(last));
+	std::string utf8_code;
+	code.toUTF8String(utf8_code);
+	auto result = py::reinterpret_steal<py::object>(Py_CompileString(utf8_code.c_str(), "<cell>", Py_eval_input));
+	if ( ! result)
+		throw py::error_already_set();
+	return result;
+}
+// The value of the cell's expression
+py::object eval_compiled_python_code(const py::object & code, py::dict & globals, py::dict & locals)
+{
+	auto result = py::reinterpret_steal<py::object>(PyEval_EvalCode(code.ptr(), globals.ptr(), locals.ptr()));
+	if ( ! result)
+		throw py::error_already_set();
 	return result;
 }
 
+// The cell and the cells depending on it are evaluated again by the evaluation thread
 bool CellData::set_formula(icu::UnicodeString contents, int col, int row)
 {
 	if (formula == contents)
@@ -1581,173 +3540,232 @@ bool CellData::set_formula(icu::UnicodeString contents, int col, int row)
 	clear_dependencies(col, row);
 
 	formula = contents;
-	bool display_changed = reevaluate(col, row);
+	global_grid->schedule_evaluation(col, row);
+	return true;
+}
+
+// Finds the cells the formula refers to and compiles it for native evaluation,
+// unless it was already compiled for the current formula.
+void CellData::compile()
+{
+	if (is_compiled && compiled_formula == formula)
+		return;
+
+	compiled_code = py::object();
+	native_code.clear();
+	references.clear();
+	compiled_formula = formula;
+	is_compiled = true;
+
+	if (formula.length() == 0 ||  formula[0] != '=')
+		return;
 
-	// update dependent cells
-	for (const auto & p : dependent_cells)
+	for (const auto & r : extract_cell_references(formula, 1))
 	{
-		auto * cell = global_grid->get_cell_at(p.x, p.y);
-		cell->reevaluate(p.x, p.y);
+		unsigned int max_x = std::min(r.rect.downright.x, global_grid->get_col_count()-1);
+		unsigned int max_y = std::min(r.rect.downright.y, global_grid->get_row_count()-1);
+		for (unsigned int y=r.rect.upleft.y ; y<=max_y ; ++y)
+			for (unsigned int x=r.rect.upleft.x ; x<=max_x ; ++x)
+				references.push_back(CellCoords{x, y});
 	}
+	std::sort(std::begin(references), std::end(references));
+	references.erase(std::unique(std::begin(references), std::end(references)), std::end(references));
 
-	return display_changed;
+	native_code = compile_native_formula(formula);
 }
 
-bool CellData::reevaluate(int col, int row)
+icu::UnicodeString CellData::get_python_code(int col, int row)
 {
-	bool display_changed;
-	auto & locals  = global_grid->locals;
-	auto & globals = global_grid->globals;
-	bool there_was_en_error = error;
-
 	if (formula.length() == 0 ||  formula[0] != '=')
-	{
-		auto code = get_string_python_code(formula, col, row);
-		std::string utf8_code;
-		code.toUTF8String(utf8_code);
-		//std::cout << utf8_code << std::endl;
-		try
-		{
-			py::exec(utf8_code, globals, locals);
-			auto display_text = locals["ourcalc_display_text"].cast<std::string>();
-			type              = locals["ourcalc_display_type"].cast<std::string>();
-			display_changed = display.set_text(display_text);
+		return get_string_python_code(formula, col, row);
+	return get_formula_python_code(get_python_expression(formula, extract_cell_references(formula, 1)), col, row);
+}
+// Python code of the formula, compiled on first use. Throws on python errors.
+const py::object & CellData::get_compiled_code(int col, int row)
+{
+	compile();
+	if ( ! compiled_code)
+		compiled_code = compile_python_code(get_python_code(col, row));
+	return compiled_code;
+}
 
-			//std::cout << "Display text: " << display_text << std::endl;
-			error = false;
-		}
-		catch(std::exception & e)
-		{
-			std::cout << e.what() << " " << __FILE__ << ": " << __LINE__ << std::endl;
-			error = true;
-			error_msg = e.what();
-			display_changed = !there_was_en_error;
-		}
-		catch(...)
-		{
-			std::cout << "unknown exception" << " " << __FILE__ << ": " << __LINE__ << std::endl;
-			error = true;
-			error_msg = "Unknown exception while evaluating expression.";
-			display_changed = !there_was_en_error;
-		}
-		return display_changed;
+// Gives python the values computed without it, for the cells it is about to use
+void sync_python_values(const std::vector<CellCoords> & cells)
+{
+	for (const auto & p : cells)
+	{
+		auto * cell = global_grid->get_cell_at(p.x, p.y);
+		if ( ! cell || ! cell->python_outdated)
+			continue;
+		global_grid->locals[get_cell_name_string(p.x, p.y).c_str()].attr("set_val")(native_value_to_python(cell->number));
+		cell->python_outdated = false;
 	}
+}
 
-	//std::cout << formula << std::endl;
-	//std::cout << formula.substr(1) << std::endl;
-	//std::cout << code << std::endl;
-	auto formula_code = get_formula_python_code(formula, col, row);
-	auto  parser_code = get_parse_python_code(formula);
-	std::string utf8_formula_code;
-	std::string utf8_parser_code;
-	formula_code.toUTF8String(utf8_formula_code);
-	 parser_code.toUTF8String(utf8_parser_code);
-	//std::cout << utf8_formula_code << std::endl;
-	try
+// Compiles the formula and adds its dependencies, before the cell is evaluated.
+// Circular dependencies found before are tried again, as an edit may have broken the cycle.
+void CellData::prepare(int col, int row)
+{
+	compile();
+	for (const auto & p : references)
 	{
-		// First parse the code
-
-		py::exec(utf8_parser_code, globals, locals);
-		std::vector<std::string> variables = split(locals["ourcalc_variables"].cast<std::string>(), ",");
+		auto * cell = global_grid->get_or_create_cell_at(p.x, p.y);
+		if ( ! cell)
+			continue;
+		if (dependencies.count(p) && ! cyclic_dependencies.count(p))
+			continue;
+		if (global_grid->add_to_topological_order(p, CellCoords{(unsigned)col, (unsigned)row}))
+			cyclic_dependencies.erase(p);
+		else
+			cyclic_dependencies.insert(p);
+		dependencies.insert(p);
+		cell->add_dependent(col, row);
+	}
+}
 
-		error = false;
-		// Check for dependency cells that contain error
-		for (const std::string & v : variables)
-		{
-			auto [ref_col, ref_row] = parse_cell_name(v);
-			auto * cell = global_grid->get_cell_at(ref_col, ref_row);
-			if (cell && cell->error)
-			{
-				error = true;
-				error_msg = v + std::string(" has an error.");
-				//return true;
-			}
-		}
+// The evaluation, in the evaluation thread, of the cells that don't need python: errors and
+// plain arithmetic. Returns false if the cell needs python.
+// It reads the cells, but changes only what the evaluation thread owns.
+bool CellData::evaluate_without_python([[maybe_unused]]int col, [[maybe_unused]]int row, eval_result & result, eval_profiler::lap_t & lap)
+{
+	result.profile.evaluations = 1;
+	if (formula.length() == 0 ||  formula[0] != '=')
+		return false;
 
-		// add dependecies cells
-		for (const std::string & v : variables)
+	// Check for dependency cells that contain error
+	for (const auto & p : references)
+	{
+		auto * cell = global_grid->get_cell_at(p.x, p.y);
+		if (cell && cell->evaluation_error)
 		{
-			auto [ref_col, ref_row] = parse_cell_name(v);
-			auto * cell = global_grid->get_cell_at(ref_col, ref_row);
-			if ( ! cell)
-				continue;
-			dependencies.insert(CellCoords{ref_col, ref_row});
-			cell->add_dependent(col, row);
+			result.error = true;
+			result.error_msg = get_cell_name_string(p.x, p.y) + std::string(" has an error.");
 		}
+	}
+	if ( ! cyclic_dependencies.empty())
+	{
+		result.error = true;
+		result.error_msg = "Circula dependency";
+	}
+	evaluation_error = result.error;
+	lap.next(eval_profiler::parse);
+	if (result.error)
+		return true;
 
-		// check for circular dependencies
-		if (this->do_dependencies_depend_on_us(dependencies, col, row))
+	NativeValue native_result;
+	auto get_cell_number = [](CellCoords p, NativeValue & v)
 		{
-			error = true;
-			error_msg = "Circula dependency";
-		}
-
-		// Now execute the code
-
-		py::exec(utf8_formula_code, globals, locals);
-		auto calculated_text = locals["ourcalc_display_text"].cast<std::string>();
-		auto calculated_type = locals["ourcalc_display_type"].cast<std::string>();
+			auto * cell = global_grid->get_cell_at(p.x, p.y);
+			if ( ! cell || cell->evaluation_error || cell->number.type == NativeValue::type_t::none)
+				return false;
+			v = cell->number;
+			return true;
+		};
+	// time of a failed native evaluation included
+	bool evaluated = ! native_code.empty() && evaluate_native_formula(native_code, get_cell_number, native_result);
+	lap.next(eval_profiler::native);
+	if ( ! evaluated)
+		return false;
+	result.display = native_value_to_string(native_result);
+	result.type    = native_value_type(native_result);
+	number = native_result;
+	python_outdated = true;
+	lap.next(eval_profiler::conversion);
+	return true;
+}
 
+void CellData::evaluate_with_python(int col, int row, eval_result & result, eval_profiler::lap_t & lap)
+{
+	auto & locals  = global_grid->locals;
+	auto & globals = global_grid->globals;
+	try
+	{
+		const auto & code = get_compiled_code(col, row);
+		lap.next(eval_profiler::parse);
+		sync_python_values(references);
+		auto value = eval_compiled_python_code(code, globals, locals);
+		lap.next(eval_profiler::python);
+		result.display = py::str(set_python_value(value, result)).cast<std::string>();
+		lap.next(eval_profiler::conversion);
 
 		//std::cout << "Display text: " << display_text << std::endl;
-
-		//std::cout << variables.size() << " variables in code: ";
-		//for (auto & v : variables)
-		//	std::cout << v;
-		//std::cout << std::endl;
-
-		if ( ! error)
-		{
-			type = calculated_type;
-			display_changed = there_was_en_error;
-			display_changed |= display.set_text(calculated_text);
-		}
+		evaluation_error = false;
 	}
 	catch(std::exception & e)
 	{
 		std::cout << e.what() << " " << __FILE__ << ": " << __LINE__ << std::endl;
-		error = true;
-		error_msg = e.what();
-		display_changed = !there_was_en_error;
+		evaluation_error = result.error = true;
+		result.error_msg = e.what();
 	}
 	catch(...)
 	{
 		std::cout << "unknown exception" << " " << __FILE__ << ": " << __LINE__ << std::endl;
-		error = true;
-		error_msg = "Unknown exception while evaluating expression.";
-		display_changed = !there_was_en_error;
+		evaluation_error = result.error = true;
+		result.error_msg = "Unknown exception while evaluating expression.";
 	}
-	return display_changed;
 }
 
-void CellData::clear_dependencies(unsigned int col, unsigned int row)
+// Takes the answer of a worker process, see worker_pool in ourcalc.py
+void CellData::set_python_result(int col, int row, const py::tuple & answer, eval_result & result)
 {
-	for (auto & p : dependencies)
+	auto status = answer[0].cast<std::string>();
+	if (status == "error")
 	{
-		auto * cell = global_grid->get_cell_at(p.x, p.y);
-		if ( ! cell)
-			continue;
-		cell->remove_dependent(col, row);
+		evaluation_error = result.error = true;
+		result.error_msg = answer[1].cast<std::string>();
+		return;
 	}
-	dependencies.clear();
+	auto & locals = global_grid->locals;
+	py::tuple value = answer[2].cast<py::tuple>();
+	py::object cell_value;
+	if (value[0].cast<std::string>() == "ref")
+		cell_value = locals[get_cell_name_string(value[1].cast<int>(), value[2].cast<int>()).c_str()];
+	else
+		cell_value = value[1];
+	locals[get_cell_name_string(col, row).c_str()].attr("set_val")(cell_value);
+	set_python_value(cell_value, result);
+	result.display = answer[1].cast<std::string>();
+	evaluation_error = false;
 }
 
-bool CellData::do_dependencies_depend_on_us(decltype(dependencies) deps, unsigned int col, unsigned int row)
+// Takes the type and number of the value python gave the cell. Returns the value, references followed.
+py::object CellData::set_python_value(const py::object & value, eval_result & result)
 {
-	auto this_pair = CellCoords{col, row};
-	for (const auto & p : deps)
-		if (p == this_pair)
-			return true;
-	deps.insert(this_pair);
-	for (const auto & p : dependent_cells)
+	py::object final_value = value;
+	if (PyObject_TypeCheck(value.ptr(), (PyTypeObject*)global_grid->ourcell_type.ptr()))
+		final_value = value.attr("get_final_val")();
+	result.type = classify_python_value(final_value.ptr(), number);
+	python_outdated = false;
+	return final_value;
+}
+
+// Shows the result of an evaluation. The caller draws the cell again, for its calculating mark at least.
+void CellData::apply(const eval_result & result)
+{
+	pending = false;
+	error = result.error;
+	if (error)
+		error_msg = result.error_msg;
+	else
+	{
+		type = result.type;
+		set_display(result.display);
+	}
+}
+
+void CellData::clear_dependencies(unsigned int col, unsigned int row)
+{
+	for (auto & p : dependencies)
 	{
 		auto * cell = global_grid->get_cell_at(p.x, p.y);
 		if ( ! cell)
 			continue;
-		if (cell->do_dependencies_depend_on_us(deps, p.x, p.y))
-			return true;
+		cell->remove_dependent(col, row);
+		if (p != CellCoords{col, row})
+			global_grid->release_cell_if_unused(p.x, p.y);
 	}
-	return false;
+	dependencies.clear();
+	cyclic_dependencies.clear();
 }
 
 horizontal_policy::alignment_t CellData::get_horizontal_alignment() const
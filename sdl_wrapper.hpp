@@ -5,6 +5,8 @@
 
 #include <vector>
 #include <memory>
+#include <unordered_map>
+#include <list>
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_ttf.h>
 #include <SDL2/SDL_image.h>
@@ -32,6 +34,7 @@ enum Scancode
 	Delete,
 	F1,
 	F2,
+	F12,
 };
 
 enum MouseCursorImg
@@ -51,12 +54,113 @@ enum MouseCursorImg
     NB_CURSOR,
 };
 
+// Glyphs of a font, rasterized once in white into shared textures (pages),
+// and colored when drawn.
+struct GlyphAtlas
+{
+	struct glyph
+	{
+		int page;
+		SDL_Rect rect; // in the page, empty for blank glyphs
+		int advance;
+	};
+
+	inline static const int page_size = 1024;
+
+	SDL_Renderer * renderer;
+	TTF_Font * font;
+	int height;
+	std::vector<SDL_Texture*> pages;
+	std::unordered_map<char16_t, glyph> glyphs;
+	bool has_kerning;
+	std::unordered_map<uint32_t, int> kernings; // by pair of characters
+	// current shelf of the last page
+	int shelf_x = 0;
+	int shelf_y = 0;
+	int shelf_h = 0;
+
+	GlyphAtlas(SDL_Renderer * r, TTF_Font * f)
+		: renderer(r)
+		, font(f)
+		, height(TTF_FontHeight(f))
+		, has_kerning(TTF_GetFontKerning(f) != 0)
+	{}
+	~GlyphAtlas()
+	{
+		for (SDL_Texture * page : pages)
+			SDL_DestroyTexture(page);
+	}
+
+	const glyph & get_glyph(char16_t c)
+	{
+		auto it = glyphs.find(c);
+		if (it != std::end(glyphs))
+			return it->second;
+
+		glyph g{0, SDL_Rect{0,0,0,0}, 0};
+		int minx, maxx, miny, maxy, advance;
+		if (TTF_GlyphMetrics(font, c, &minx, &maxx, &miny, &maxy, &advance) == 0)
+			g.advance = advance;
+
+		SDL_Surface * rendered = TTF_RenderGlyph_Blended(font, c, SDL_Color{255,255,255,255});
+		SDL_Surface * surface = rendered ? SDL_ConvertSurfaceFormat(rendered, SDL_PIXELFORMAT_ARGB8888, 0) : nullptr;
+		if (surface && surface->w > 0 && surface->h > 0 && surface->w <= page_size && surface->h <= page_size)
+		{
+			g.rect = allocate(surface->w, surface->h);
+			g.page = pages.size()-1;
+			SDL_UpdateTexture(pages.back(), &g.rect, surface->pixels, surface->pitch);
+		}
+		if (surface)
+			SDL_FreeSurface(surface);
+		if (rendered)
+			SDL_FreeSurface(rendered);
+
+		return glyphs.emplace(c, g).first->second;
+	}
+	int get_kerning(char16_t previous, char16_t c)
+	{
+		if ( ! has_kerning)
+			return 0;
+		uint32_t key = ((uint32_t)previous << 16) | c;
+		auto it = kernings.find(key);
+		if (it == std::end(kernings))
+			it = kernings.emplace(key, TTF_GetFontKerningSizeGlyphs(font, previous, c)).first;
+		return it->second;
+	}
+
+private:
+	// space in the last page, on a new page if it is full
+	SDL_Rect allocate(int w, int h)
+	{
+		if ( ! pages.empty() && shelf_x + w > page_size)
+		{
+			shelf_x = 0;
+			shelf_y += shelf_h;
+			shelf_h = 0;
+		}
+		if (pages.empty() || shelf_y + h > page_size)
+		{
+			SDL_Texture * page = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, page_size, page_size);
+			SDL_SetTextureBlendMode(page, SDL_BLENDMODE_BLEND);
+			pages.push_back(page);
+			shelf_x = 0;
+			shelf_y = 0;
+			shelf_h = 0;
+		}
+		SDL_Rect result{shelf_x, shelf_y, w, h};
+		shelf_x += w;
+		shelf_h = std::max(shelf_h, h);
+		return result;
+	}
+};
+
 struct Window
 {
 	SDL_Surface* winSurface = NULL;
 	SDL_Window* sdl_window = NULL;
 	SDL_Renderer* renderer = NULL;
 	TTF_Font * font;
+	std::unique_ptr<GlyphAtlas> glyph_atlas;
 	int w, h;
 	MouseCursorImg current_cursor = MouseCursorImg::ARROW;
 	std::vector<SDL_Cursor*> mouse_cursors;
@@ -65,7 +169,7 @@ struct Window
 		: w(width)
 		, h(height)
 	{
-		sdl_window = SDL_CreateWindow(title, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, width, height, SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE | SDL_RENDERER_PRESENTVSYNC);
+		sdl_window = SDL_CreateWindow(title, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, width, height, SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
 		if ( ! sdl_window)
 			throw;
 
@@ -73,21 +177,44 @@ struct Window
 		if ( ! winSurface)
 			throw;
 
-		renderer = SDL_CreateRenderer(sdl_window, -1, SDL_RENDERER_ACCELERATED);
+		renderer = SDL_CreateRenderer(sdl_window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
 		if ( ! renderer)
 			throw;
 
-		font = TTF_OpenFont("ttf/UbuntuMono-R.ttf", 16);
-		if ( ! font)
-			throw;
+		open_font();
 
 		for (int i=0 ; i<SDL_SystemCursor::SDL_NUM_SYSTEM_CURSORS ; ++i)
 			mouse_cursors.push_back(SDL_CreateSystemCursor((SDL_SystemCursor)i));
 	}
+	// Draws into the surface with the software renderer, without any window nor display
+	Window(SDL_Surface * surface)
+		: winSurface(surface)
+		, w(surface ? surface->w : 0)
+		, h(surface ? surface->h : 0)
+	{
+		if ( ! winSurface)
+			throw;
+
+		renderer = SDL_CreateSoftwareRenderer(winSurface);
+		if ( ! renderer)
+			throw;
+
+		open_font();
+	}
 	virtual ~Window()
 	{
 		//TTF_CloseFont(font);
-		SDL_DestroyWindow(sdl_window);
+		glyph_atlas.reset();
+		if (sdl_window)
+			SDL_DestroyWindow(sdl_window);
+	}
+
+	void open_font()
+	{
+		font = TTF_OpenFont("ttf/UbuntuMono-R.ttf", 16);
+		if ( ! font)
+			throw;
+		glyph_atlas = std::make_unique<GlyphAtlas>(renderer, font);
 	}
 
 	// returns the previous cursor
@@ -96,7 +223,8 @@ struct Window
 		if (n == current_cursor)
 			return n;
 		auto c = current_cursor;
-		SDL_SetCursor(mouse_cursors[n]);
+		if (n < (int)mouse_cursors.size())
+			SDL_SetCursor(mouse_cursors[n]);
 		current_cursor = n;
 		return c;
 	}
@@ -198,12 +326,11 @@ enum class text_change_t
 	resized,
 	text_changed,
 };
+// Text is drawn glyph by glyph from its window's GlyphAtlas, it owns no texture
 struct Text : monitorable<text_change_t>
 {
 	Window * window = nullptr;
-	SDL_Surface* message_surface = nullptr;
-	SDL_Texture* message_texture = nullptr;
-	int w, h;
+	int w = 0, h = 0;
 	icu::UnicodeString text;
 	std::vector<int> char_pos;
 	SDL_Color color;
@@ -218,24 +345,18 @@ struct Text : monitorable<text_change_t>
 		: window(win)
 		, color{r, g, b, a}
 	{
-		set_text(s);
+		text = s;
+		calculate_char_pos();
+		render();
 	}
 	Text(const Text & other)
 		: window(other.window)
 		, w(other.w)
 		, h(other.h)
+		, text(other.text)
+		, char_pos(other.char_pos)
 		, color(other.color)
-	{
-		set_text(other.text);
-	}
-	~Text()
-	{
-		if (message_texture)
-			SDL_DestroyTexture(message_texture);
-		if (message_surface)
-			SDL_FreeSurface(message_surface);
-	}
-
+	{}
 	Text & operator=(const Text & other)
 	{
 		set_text(other.text);
@@ -246,11 +367,16 @@ struct Text : monitorable<text_change_t>
 	const icu::UnicodeString & get_text() const { return text; }
 	bool set_text(icu::UnicodeString s)
 	{
-		if (text == s && message_texture != nullptr)
+		if (text == s)
 			return false;
+		// the characters before the first difference keep their positions
+		int32_t unchanged = 0;
+		int32_t common_length = std::min(text.length(), s.length());
+		while (unchanged < common_length && text[unchanged] == s[unchanged])
+			++unchanged;
 		text = s;
+		calculate_char_pos(unchanged);
 		render();
-		calculate_char_pos();
 		notify_monitors(text_change_t::text_changed);
 		return true;
 	}
@@ -259,55 +385,27 @@ struct Text : monitorable<text_change_t>
 		return set_text(icu::UnicodeString::fromUTF8(s));
 	}
 
-	void calculate_char_pos()
+	// positions of the ends of the characters, recomputed from the character from_idx
+	void calculate_char_pos(int from_idx = 0)
 	{
-		char_pos.clear();
+		auto & atlas = *window->glyph_atlas;
+		char_pos.resize(from_idx);
 		char_pos.reserve(text.length());
-		icu::UnicodeString tmp_text;
-		//tmp_text.reserve(text.length());
-		for (int i=0 ; i<(int)text.length() ; i++)
+		int x = from_idx > 0 ? char_pos.back() : 0;
+		for (int i=from_idx ; i<(int)text.length() ; i++)
 		{
-			tmp_text.append(text[i]);
-			int calculated_width;
-			int dummy;
-			//TTF_MeasureText(window->font, tmp_text.c_str(), w, &calculated_width, &dummy);
-			std::string converted;
-			tmp_text.toUTF8String(converted);
-			TTF_SizeText(window->font, converted.c_str(), &calculated_width, &dummy);
-			char_pos.push_back(calculated_width);
+			if (i > 0)
+				x += atlas.get_kerning(text[i-1], text[i]);
+			x += atlas.get_glyph(text[i]).advance;
+			char_pos.push_back(x);
 		}
 	}
 
+	// size of the text, as laid out by DrawableArea::copy_text_part
 	void render()
 	{
-		if ( ! text.length())
-		{
-			if (message_texture)
-				SDL_DestroyTexture(message_texture);
-			message_texture = SDL_CreateTexture(window->renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, 0, 0);
-			//SDL_RenderFillRect
-			SDL_SetTextureBlendMode(message_texture, SDL_BLENDMODE_BLEND);
-			return;
-		}
-
-		if (message_surface)
-			SDL_FreeSurface(message_surface);
-
-		// pre-render text
-		std::string converted;
-		text.toUTF8String(converted);
-		message_surface = TTF_RenderUTF8_Blended(window->font, converted.c_str(), color);
-		message_texture = SDL_CreateTextureFromSurface(window->renderer, message_surface);
-		SDL_SetTextureBlendMode(message_texture, SDL_BLENDMODE_BLEND);
-
-	    w = message_surface->w;
-	    h = message_surface->h;
-
-		if (message_surface)
-		{
-			SDL_FreeSurface(message_surface);
-			message_surface = nullptr;
-		}
+		h = window->glyph_atlas->height;
+		w = char_pos.empty() ? 0 : char_pos.back();
 	}
 	int get_pos_at(int x)
 	{
@@ -322,6 +420,61 @@ struct Text : monitorable<text_change_t>
 	}
 };
 
+// Texts of one color, laid out when first drawn. The least recently used
+// ones are dropped once their estimated memory exceeds the budget.
+struct TextCache
+{
+	struct hash
+	{
+		size_t operator()(const icu::UnicodeString & s) const { return s.hashCode(); }
+	};
+
+	Window * window;
+	SDL_Color color;
+	size_t budget; // bytes
+	size_t used = 0;
+	std::list<Text> texts; // most recently used first
+	std::unordered_map<icu::UnicodeString, std::list<Text>::iterator, hash> index;
+
+	TextCache(Window * win, SDL_Color c, size_t budget_bytes)
+		: window(win)
+		, color(c)
+		, budget(budget_bytes)
+	{}
+
+	// valid until the next call
+	const Text & get(const icu::UnicodeString & s)
+	{
+		auto it = index.find(s);
+		if (it != std::end(index))
+		{
+			texts.splice(std::begin(texts), texts, it->second);
+			return texts.front();
+		}
+
+		texts.emplace_front(s, window, color.r, color.g, color.b, color.a);
+		index.emplace(s, std::begin(texts));
+		used += get_size(texts.front());
+		while (used > budget && texts.size() > 1)
+		{
+			used -= get_size(texts.back());
+			index.erase(texts.back().text);
+			texts.pop_back();
+		}
+		return texts.front();
+	}
+	void set_budget(size_t budget_bytes)
+	{
+		budget = budget_bytes;
+	}
+
+private:
+	static size_t get_size(const Text & text)
+	{
+		return sizeof(Text) + text.text.length() * (sizeof(char16_t) + sizeof(int)) + sizeof(void*) * 6;
+	}
+};
+
 template<typename T, typename D=std::default_delete<T>>
 class ourunique_ptr : public std::unique_ptr<T,D>
 {
@@ -346,13 +499,27 @@ struct DrawableArea
 	int wo, ho;
 	SDL_Rect rect_src;
 
-	DrawableArea(Window * window, int width, int height)
+	// glyphs queued by the copy_from_text functions, drawn at once by flush()
+	struct glyph_batch
+	{
+		SDL_Texture * texture;
+		std::vector<SDL_Vertex> vertices;
+		std::vector<int> indices;
+	};
+	std::vector<glyph_batch> pending_glyphs;
+
+	// when set, drawing only touches this part of the area
+	bool has_clip = false;
+	SDL_Rect clip;
+
+	// an area of exact size is never resized, it doesn't keep room to grow
+	DrawableArea(Window * window, int width, int height, bool exact_size = false)
 		: renderer(window->renderer)
 		, texture(nullptr, &SDL_DestroyTexture)
 		, w(width)
 		, h(height)
-		, wo(width*2)
-		, ho(height*2)
+		, wo(exact_size ? width : width*2)
+		, ho(exact_size ? height : height*2)
 	{
 		texture.reset(SDL_CreateTexture(window->renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, wo, ho));
 		SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
@@ -364,6 +531,7 @@ struct DrawableArea
 
 	void set_size(std::pair<int,int> size)
 	{
+		flush();
 		if (std::get<0>(size) > wo || std::get<1>(size) > ho)
 		{
 			texture.reset(SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, std::get<0>(size)*2, std::get<1>(size)*2));
@@ -378,27 +546,116 @@ struct DrawableArea
 		rect_src.h = h;
 	}
 
+	// SDL forgets the clip rect when the render target changes
+	void target()
+	{
+		SDL_SetRenderTarget(renderer, texture);
+		if (has_clip)
+			SDL_RenderSetClipRect(renderer, &clip);
+	}
+	void untarget()
+	{
+		if (has_clip)
+			SDL_RenderSetClipRect(renderer, NULL);
+		SDL_SetRenderTarget(renderer, NULL);
+	}
+	void set_clip(int x, int y, int w, int h)
+	{
+		flush();
+		has_clip = true;
+		clip = SDL_Rect{x, y, w, h};
+	}
+	void reset_clip()
+	{
+		flush();
+		has_clip = false;
+	}
+
+	// draws the queued glyphs, before anything else is drawn on top
+	void flush()
+	{
+		if (pending_glyphs.empty())
+			return;
+		target();
+		for (auto & batch : pending_glyphs)
+			SDL_RenderGeometry(renderer, batch.texture, batch.vertices.data(), batch.vertices.size(), batch.indices.data(), batch.indices.size());
+		untarget();
+		pending_glyphs.clear();
+	}
+
 	void copy_from(DrawableArea & other, int x, int y)
 	{
+		flush();
+		other.flush();
 		SDL_Rect rect;
 		rect.x = x;
 		rect.y = y;
 		rect.w = other.w;
 		rect.h = other.h;
-		SDL_SetRenderTarget(renderer, texture);
+		target();
 		SDL_RenderCopy(renderer, other.texture, &other.rect_src, &rect);
-		SDL_SetRenderTarget(renderer, NULL);
+		untarget();
+	}
+	// copies the part of other at src_x, src_y, of size w x h, to x, y
+	void copy_from(DrawableArea & other, int src_x, int src_y, int w, int h, int x, int y)
+	{
+		flush();
+		other.flush();
+		SDL_Rect src{src_x, src_y, w, h};
+		SDL_Rect rect{x, y, w, h};
+		target();
+		SDL_RenderCopy(renderer, other.texture, &src, &rect);
+		untarget();
+	}
+	// when not blending, copies of this area replace what's below, transparency included
+	void set_blending(bool blending)
+	{
+		SDL_SetTextureBlendMode(texture, blending ? SDL_BLENDMODE_BLEND : SDL_BLENDMODE_NONE);
 	}
 	void copy_from(const Text & text, int x, int y)
 	{
-		SDL_Rect rect;
-		rect.x = x;
-		rect.y = y;
-		rect.w = text.w;
-		rect.h = text.h;
-		SDL_SetRenderTarget(renderer, texture);
-		SDL_RenderCopy(renderer, text.message_texture, NULL, &rect);
-		SDL_SetRenderTarget(renderer, NULL);
+		copy_text_part(text, SDL_Rect{0, 0, text.w, text.h}, x, y);
+	}
+	// Queues the glyphs of the part src of the text, src's corner going to dest
+	void copy_text_part(const Text & text, SDL_Rect src, int dest_x, int dest_y)
+	{
+		auto & atlas = *text.window->glyph_atlas;
+		// first character ending after src.x
+		int first = std::upper_bound(std::begin(text.char_pos), std::end(text.char_pos), src.x) - std::begin(text.char_pos);
+		int pen = first > 0 ? text.char_pos[first-1] : 0;
+		for (int i=first ; i<(int)text.text.length() && pen < src.x+src.w ; i++)
+		{
+			if (i > 0)
+				pen += atlas.get_kerning(text.text[i-1], text.text[i]);
+			const auto & g = atlas.get_glyph(text.text[i]);
+
+			// intersection of the glyph and src, in text coordinates
+			int x0 = std::max(pen, src.x);
+			int y0 = std::max(0, src.y);
+			int x1 = std::min(pen + g.rect.w, src.x + src.w);
+			int y1 = std::min(g.rect.h, src.y + src.h);
+			if (x0 < x1 && y0 < y1)
+				add_glyph_quad(atlas.pages[g.page],
+				               SDL_Rect{dest_x + x0 - src.x, dest_y + y0 - src.y, x1-x0, y1-y0},
+				               SDL_Rect{g.rect.x + x0 - pen, g.rect.y + y0, x1-x0, y1-y0},
+				               text.color);
+			pen += g.advance;
+		}
+	}
+	void add_glyph_quad(SDL_Texture * page, SDL_Rect dest, SDL_Rect src, SDL_Color color)
+	{
+		if (pending_glyphs.empty() || pending_glyphs.back().texture != page)
+			pending_glyphs.push_back(glyph_batch{page, {}, {}});
+		auto & batch = pending_glyphs.back();
+
+		const float size = GlyphAtlas::page_size;
+		int first = batch.vertices.size();
+		batch.vertices.push_back(SDL_Vertex{SDL_FPoint{(float)dest.x         , (float)dest.y         }, color, SDL_FPoint{ src.x         /size,  src.y         /size}});
+		batch.vertices.push_back(SDL_Vertex{SDL_FPoint{(float)dest.x + dest.w, (float)dest.y         }, color, SDL_FPoint{(src.x + src.w)/size,  src.y         /size}});
+		batch.vertices.push_back(SDL_Vertex{SDL_FPoint{(float)dest.x + dest.w, (float)dest.y + dest.h}, color, SDL_FPoint{(src.x + src.w)/size, (src.y + src.h)/size}});
+		batch.vertices.push_back(SDL_Vertex{SDL_FPoint{(float)dest.x         , (float)dest.y + dest.h}, color, SDL_FPoint{ src.x         /size, (src.y + src.h)/size}});
+		for (int i : {0, 1, 2, 0, 2, 3})
+			batch.indices.push_back(first + i);
 	}
 	void copy_from_text_to_rect_center(const Text & text, int dest_x, int dest_y, int dest_w, int dest_h)
 	{
@@ -407,169 +664,136 @@ struct DrawableArea
 		rect_srca.y = 0;
 		rect_srca.w = text.w;
 		rect_srca.h = text.h;
-		SDL_Rect rect_dest;
-		rect_dest.x = dest_x;
-		rect_dest.y = dest_y;
-		rect_dest.w = dest_w;
-		rect_dest.h = dest_h;
 		if (dest_w < text.w)
 		{
 			rect_srca.x += (text.w-dest_w)/2;
 			rect_srca.w = dest_w;
 		}
 		else if (dest_w > text.w)
-		{
-			rect_dest.x += (dest_w-text.w)/2;
-			rect_dest.w = text.w;
-		}
+			dest_x += (dest_w-text.w)/2;
 		if (dest_h < text.h)
 		{
 			rect_srca.y += (text.h-dest_h)/2;
 			rect_srca.h = dest_h;
 		}
 		else if (dest_h > text.h)
-		{
-			rect_dest.y += (dest_h-text.h)/2;
-			rect_dest.h = text.h;
-		}
-		SDL_SetRenderTarget(renderer, texture);
-		SDL_RenderCopy(renderer, text.message_texture, &rect_srca, &rect_dest);
-		SDL_SetRenderTarget(renderer, NULL);
+			dest_y += (dest_h-text.h)/2;
+		copy_text_part(text, rect_srca, dest_x, dest_y);
 	}
-	void copy_from_text_to_rect_left(Text & text, int dest_x, int dest_y, int dest_w, int dest_h)
+	void copy_from_text_to_rect_left(const Text & text, int dest_x, int dest_y, int dest_w, int dest_h)
 	{
 		SDL_Rect rect_srca;
 		rect_srca.x = 0;
 		rect_srca.y = 0;
-		rect_srca.w = text.w;
-		rect_srca.h = text.h;
-		SDL_Rect rect_dest;
-		rect_dest.x = dest_x;
-		rect_dest.y = dest_y;
-		rect_dest.w = dest_w;
-		rect_dest.h = dest_h;
-		if (dest_w < text.w)
-		{
-			rect_srca.w = dest_w;
-		}
-		else if (dest_w > text.w)
-		{
-			rect_dest.w = text.w;
-		}
-		if (dest_h < text.h)
-		{
-			rect_srca.h = dest_h;
-		}
-		else if (dest_h > text.h)
-		{
-			rect_dest.h = text.h;
-		}
-		SDL_SetRenderTarget(renderer, texture);
-		SDL_RenderCopy(renderer, text.message_texture, &rect_srca, &rect_dest);
-		SDL_SetRenderTarget(renderer, NULL);
+		rect_srca.w = std::min(text.w, dest_w);
+		rect_srca.h = std::min(text.h, dest_h);
+		copy_text_part(text, rect_srca, dest_x, dest_y);
 	}
-	void copy_from_text_to_rect_right(Text & text, int dest_x, int dest_y, int dest_w, int dest_h)
+	void copy_from_text_to_rect_right(const Text & text, int dest_x, int dest_y, int dest_w, int dest_h)
 	{
 		SDL_Rect rect_srca;
 		rect_srca.x = 0;
 		rect_srca.y = 0;
 		rect_srca.w = text.w;
 		rect_srca.h = text.h;
-		SDL_Rect rect_dest;
-		rect_dest.x = dest_x;
-		rect_dest.y = dest_y;
-		rect_dest.w = dest_w;
-		rect_dest.h = dest_h;
 		if (dest_w < text.w)
 		{
 			rect_srca.x += (text.w-dest_w);
 			rect_srca.w = dest_w;
 		}
 		else if (dest_w > text.w)
-		{
-			rect_dest.x += (dest_w-text.w);
-			rect_dest.w = text.w;
-		}
+			dest_x += (dest_w-text.w);
 		if (dest_h < text.h)
 		{
 			rect_srca.y += (text.h-dest_h);
 			rect_srca.h = dest_h;
 		}
 		else if (dest_h > text.h)
-		{
-			rect_dest.y += (dest_h-text.h);
-			rect_dest.h = text.h;
-		}
-		SDL_SetRenderTarget(renderer, texture);
-		SDL_RenderCopy(renderer, text.message_texture, &rect_srca, &rect_dest);
-		SDL_SetRenderTarget(renderer, NULL);
+			dest_y += (dest_h-text.h);
+		copy_text_part(text, rect_srca, dest_x, dest_y);
 	}
 	void refresh_window()
 	{
-		SDL_SetRenderTarget(renderer, NULL);
+		flush();
+		untarget();
 		SDL_RenderCopy(renderer, texture, &rect_src, NULL);
 	}
 
 	void fill(int r, int g, int b, int a=255)
 	{
+		flush();
 		SDL_Rect rect;
 		rect.x = 0;
 		rect.y = 0;
 		rect.w = w;
 		rect.h = h;
-		SDL_SetRenderTarget(renderer, texture);
+		target();
 	    SDL_SetRenderDrawColor(renderer, r, g, b, a);
 	    SDL_RenderFillRect(renderer, &rect);
-		SDL_SetRenderTarget(renderer, NULL);
+		untarget();
 	}
 	void draw_line(int x1, int y1, int x2, int y2, int r, int g, int b, int a=255)
 	{
-		SDL_SetRenderTarget(renderer, texture);
+		flush();
+		target();
 	    SDL_SetRenderDrawColor(renderer, r, g, b, a);
 		SDL_RenderDrawLine(renderer, x1, y1, x2, y2);
-		SDL_SetRenderTarget(renderer, NULL);
+		untarget();
 	}
 	void draw_rect(int x, int y, int w, int h, int r, int g, int b, int a=255)
 	{
+		flush();
 	    SDL_Rect rect;
 	    rect.x = x;
 	    rect.y = y;
 	    rect.w = w;
 	    rect.h = h;
 
-		SDL_SetRenderTarget(renderer, texture);
+		target();
 	    SDL_SetRenderDrawColor(renderer, r, g, b, a);
 	    SDL_RenderDrawRect(renderer, &rect);
-		SDL_SetRenderTarget(renderer, NULL);
+		untarget();
 	}
 	void draw_3d_rect(int x, int y, int w, int h, int light, int dark, bool sunken)
 	{
+		flush();
 	    if ( ! sunken)
 	    {
 	    	std::swap(dark, light);
 	    }
 
-		SDL_SetRenderTarget(renderer, texture);
+		target();
 	    SDL_SetRenderDrawColor(renderer, dark, dark, dark, 255);
 	    SDL_RenderDrawLine(renderer, x, y, x+w-1, y);
 	    SDL_RenderDrawLine(renderer, x, y, x, y+h-1);
 	    SDL_SetRenderDrawColor(renderer, light, light, light, 255);
 	    SDL_RenderDrawLine(renderer, x, y+h-1, x+w-1, y+h-1);
 	    SDL_RenderDrawLine(renderer, x+w-1, y, x+w-1, y+h);
-		SDL_SetRenderTarget(renderer, NULL);
+		untarget();
+	}
+	void fill_rects(const std::vector<SDL_Rect> & rects, int r, int g, int b, int a=255)
+	{
+		if (rects.empty())
+			return;
+		flush();
+		target();
+	    SDL_SetRenderDrawColor(renderer, r, g, b, a);
+	    SDL_RenderFillRects(renderer, rects.data(), rects.size());
+		untarget();
 	}
 	void fill_rect(int x, int y, int w, int h, int r, int g, int b, int a=255)
 	{
+		flush();
 	    SDL_Rect rect;
 	    rect.x = x;
 	    rect.y = y;
 	    rect.w = w;
 	    rect.h = h;
 
-		SDL_SetRenderTarget(renderer, texture);
+		target();
 	    SDL_SetRenderDrawColor(renderer, r, g, b, a);
 	    SDL_RenderFillRect(renderer, &rect);
-		SDL_SetRenderTarget(renderer, NULL);
+		untarget();
 	}
 };
 
@@ -602,177 +826,233 @@ struct SDL
 		return (W&)*windows.back();
 	}
 
+	// longest sleep when nothing happens
+	inline static const int idle_timeout_ms = 500;
+
+	// from any thread, an event for the loop to draw a frame
+	static void wake_up()
+	{
+		SDL_Event e{};
+		e.type = SDL_USEREVENT;
+		SDL_PushEvent(&e);
+	}
+
+	// Sleeps until events come, handles all the queued ones, then lets each
+	// window redraw once; presenting waits for the vsync, which paces the frames.
 	void loop()
 	{
 		while (true)
 		{
 			SDL_Event e;
-			while( SDL_PollEvent( &e ) != 0 )
+			if (SDL_WaitEventTimeout(&e, idle_timeout_ms))
 			{
-				switch (e.type)
+				do
 				{
-					case SDL_WINDOWEVENT:
+					// of consecutive mouse motions, only the last one matters
+					if (e.type == SDL_MOUSEMOTION)
 					{
-						SDL_Window* sdl_window = SDL_GetWindowFromID(((SDL_WindowEvent&)e).windowID);
-						if ( ! sdl_window)
-							break;
-						for(auto & window : windows)
-							if (window->sdl_window == sdl_window)
-							{
-								switch(((SDL_WindowEvent&)e).event)
-								{
-									//case SDL_WINDOWEVENT_SHOWN:
-									case SDL_WINDOWEVENT_EXPOSED:
-										window->handle_event(event{event_type::window_shown, 0});
-										break;
-									case SDL_WINDOWEVENT_MOVED:
-										break;
-									case SDL_WINDOWEVENT_ENTER:
-										window->handle_event(event{event_type::window_shown, 0});
-										break;
-									case SDL_WINDOWEVENT_RESIZED:
-										event my_event{event_type::window_resized, 0};
-										my_event.data.window_resized.w = ((SDL_WindowEvent&)e).data1;
-										my_event.data.window_resized.h = ((SDL_WindowEvent&)e).data2;
-										window->handle_event(my_event);
-										break;
-								}
-								break;
-							}
-						break;
+						SDL_Event next;
+						if (SDL_PeepEvents(&next, 1, SDL_PEEKEVENT, SDL_FIRSTEVENT, SDL_LASTEVENT) == 1
+							&& next.type == SDL_MOUSEMOTION
+							&& ((SDL_MouseMotionEvent&)next).windowID == ((SDL_MouseMotionEvent&)e).windowID
+							&& ((SDL_MouseMotionEvent&)next).state    == ((SDL_MouseMotionEvent&)e).state)
+							continue;
 					}
-					case SDL_MOUSEMOTION:
+					if ( ! handle_sdl_event(e))
+						return;
+				}
+				while (SDL_PollEvent(&e));
+			}
+
+			for (auto & window : windows)
+				window->_redraw();
+		}
+	}
+
+	// returns false when the application quits
+	bool handle_sdl_event(SDL_Event & e)
+	{
+		switch (e.type)
+		{
+			case SDL_WINDOWEVENT:
+			{
+				SDL_Window* sdl_window = SDL_GetWindowFromID(((SDL_WindowEvent&)e).windowID);
+				if ( ! sdl_window)
+					break;
+				for(auto & window : windows)
+					if (window->sdl_window == sdl_window)
 					{
-						SDL_MouseMotionEvent & ev = (SDL_MouseMotionEvent &)e;
-
-						SDL_Window * sdl_window = SDL_GetWindowFromID(ev.windowID);
-						if ( ! sdl_window)
-							break;
-						for(auto & window : windows)
-							if (window->sdl_window == sdl_window)
-							{
-								event my_event{event_type::mouse, 0};
-								my_event.data.mouse.pressed  = false;
-								my_event.data.mouse.released = false;
-								my_event.data.mouse.button = 0;
-								my_event.data.mouse.x = ev.x; //-1; // circumventing sdl bug (?)
-								my_event.data.mouse.y = ev.y; //-2; // circumventing sdl bug (?)
+						switch(((SDL_WindowEvent&)e).event)
+						{
+							//case SDL_WINDOWEVENT_SHOWN:
+							case SDL_WINDOWEVENT_EXPOSED:
+								window->handle_event(event{event_type::window_shown, 0});
+								break;
+							case SDL_WINDOWEVENT_MOVED:
+								break;
+							case SDL_WINDOWEVENT_ENTER:
+								window->handle_event(event{event_type::window_shown, 0});
+								break;
+							case SDL_WINDOWEVENT_RESIZED:
+								event my_event{event_type::window_resized, 0};
+								my_event.data.window_resized.w = ((SDL_WindowEvent&)e).data1;
+								my_event.data.window_resized.h = ((SDL_WindowEvent&)e).data2;
 								window->handle_event(my_event);
 								break;
-							}
+						}
+						break;
+					}
+				break;
+			}
+			case SDL_MOUSEMOTION:
+			{
+				SDL_MouseMotionEvent & ev = (SDL_MouseMotionEvent &)e;
 
+				SDL_Window * sdl_window = SDL_GetWindowFromID(ev.windowID);
+				if ( ! sdl_window)
+					break;
+				for(auto & window : windows)
+					if (window->sdl_window == sdl_window)
+					{
+						event my_event{event_type::mouse, 0};
+						my_event.data.mouse.pressed  = false;
+						my_event.data.mouse.released = false;
+						my_event.data.mouse.button = 0;
+						my_event.data.mouse.x = ev.x; //-1; // circumventing sdl bug (?)
+						my_event.data.mouse.y = ev.y; //-2; // circumventing sdl bug (?)
+						window->handle_event(my_event);
 						break;
 					}
-					case SDL_MOUSEBUTTONDOWN:
-					case SDL_MOUSEBUTTONUP:
+
+				break;
+			}
+			case SDL_MOUSEBUTTONDOWN:
+			case SDL_MOUSEBUTTONUP:
+			{
+				SDL_MouseButtonEvent & ev = (SDL_MouseButtonEvent&) e;
+
+				SDL_Window * sdl_window = SDL_GetWindowFromID(ev.windowID);
+				if ( ! sdl_window)
+					break;
+				for(auto & window : windows)
+					if (window->sdl_window == sdl_window)
 					{
-						SDL_MouseButtonEvent & ev = (SDL_MouseButtonEvent&) e;
-
-						SDL_Window * sdl_window = SDL_GetWindowFromID(ev.windowID);
-						if ( ! sdl_window)
-							break;
-						for(auto & window : windows)
-							if (window->sdl_window == sdl_window)
-							{
-								event my_event{event_type::mouse, 0};
-								my_event.data.mouse.pressed  = e.type == SDL_MOUSEBUTTONDOWN;
-								my_event.data.mouse.released = e.type == SDL_MOUSEBUTTONUP;
-								my_event.data.mouse.button = ev.button;
-								my_event.data.mouse.x = ev.x; //-1; // circumventing sdl bug (?)
-								my_event.data.mouse.y = ev.y; //-2; // circumventing sdl bug (?)
-								window->handle_event(my_event);
-								break;
-							}
+						event my_event{event_type::mouse, 0};
+						my_event.data.mouse.pressed  = e.type == SDL_MOUSEBUTTONDOWN;
+						my_event.data.mouse.released = e.type == SDL_MOUSEBUTTONUP;
+						my_event.data.mouse.button = ev.button;
+						my_event.data.mouse.x = ev.x; //-1; // circumventing sdl bug (?)
+						my_event.data.mouse.y = ev.y; //-2; // circumventing sdl bug (?)
+						window->handle_event(my_event);
 						break;
 					}
-					case SDL_KEYDOWN:
-					case SDL_KEYUP:
+				break;
+			}
+			case SDL_MOUSEWHEEL:
+			{
+				SDL_MouseWheelEvent & ev = (SDL_MouseWheelEvent&) e;
+
+				SDL_Window * sdl_window = SDL_GetWindowFromID(ev.windowID);
+				if ( ! sdl_window)
+					break;
+				int direction = ev.direction == SDL_MOUSEWHEEL_FLIPPED ? -1 : 1;
+				for(auto & window : windows)
+					if (window->sdl_window == sdl_window)
 					{
-						SDL_KeyboardEvent & ev = (SDL_KeyboardEvent&) e;
-						SDL_Window * sdl_window = SDL_GetWindowFromID(ev.windowID);
-						if ( ! sdl_window)
-							break;
-						event my_event{event_type::key, 0};
-						my_event.data.key.pressed  = e.type == SDL_KEYDOWN;
-						my_event.data.key.released = e.type == SDL_KEYUP;
-						my_event.data.key.charcode = ev.keysym.sym;
-						my_event.data.key.mod      = ev.keysym.mod;
-						switch (ev.keysym.scancode)
-						{
-							case SDL_SCANCODE_UP           : my_event.data.key.keycode = Scancode::Up        ; break;
-							case SDL_SCANCODE_DOWN         : my_event.data.key.keycode = Scancode::Down      ; break;
-							case SDL_SCANCODE_LEFT         : my_event.data.key.keycode = Scancode::Left      ; break;
-							case SDL_SCANCODE_RIGHT        : my_event.data.key.keycode = Scancode::Right     ; break;
-							case SDL_SCANCODE_LCTRL        : my_event.data.key.keycode = Scancode::Ctrl      ; break;
-							case SDL_SCANCODE_RCTRL        : my_event.data.key.keycode = Scancode::Ctrl      ; break;
-							case SDL_SCANCODE_LSHIFT       : my_event.data.key.keycode = Scancode::Shift     ; break;
-							case SDL_SCANCODE_RSHIFT       : my_event.data.key.keycode = Scancode::Shift     ; break;
-							case SDL_SCANCODE_LALT         : my_event.data.key.keycode = Scancode::Alt       ; break;
-							case SDL_SCANCODE_RALT         : my_event.data.key.keycode = Scancode::Altgr     ; break;
-							case SDL_SCANCODE_KP_ENTER     : my_event.data.key.keycode = Scancode::Enter     ; break;
-							case SDL_SCANCODE_RETURN       : my_event.data.key.keycode = Scancode::Enter     ; break;
-							case SDL_SCANCODE_ESCAPE       : my_event.data.key.keycode = Scancode::Esc       ; break;
-							case SDL_SCANCODE_F1           : my_event.data.key.keycode = Scancode::F1        ; break;
-							case SDL_SCANCODE_F2           : my_event.data.key.keycode = Scancode::F2        ; break;
-							case SDL_SCANCODE_BACKSPACE    : my_event.data.key.keycode = Scancode::Backspace ; break;
-							case SDL_SCANCODE_KP_BACKSPACE : my_event.data.key.keycode = Scancode::Backspace ; break;
-							case SDL_SCANCODE_DELETE       : my_event.data.key.keycode = Scancode::Delete    ; break;
-
-								
-							default:
-								break;
-						}
-						for(auto & window : windows)
-							if (window->sdl_window == sdl_window)
-							{
-								window->handle_event(my_event);
-								break;
-							}
+						event my_event{event_type::mouse_wheel, 0};
+						SDL_GetMouseState(&my_event.data.mouse_wheel.x, &my_event.data.mouse_wheel.y);
+						my_event.data.mouse_wheel.scroll_x = ev.x * direction;
+						my_event.data.mouse_wheel.scroll_y = ev.y * direction;
+						window->handle_event(my_event);
 						break;
 					}
-					case SDL_TEXTINPUT:
+				break;
+			}
+			case SDL_KEYDOWN:
+			case SDL_KEYUP:
+			{
+				SDL_KeyboardEvent & ev = (SDL_KeyboardEvent&) e;
+				SDL_Window * sdl_window = SDL_GetWindowFromID(ev.windowID);
+				if ( ! sdl_window)
+					break;
+				event my_event{event_type::key, 0};
+				my_event.data.key.pressed  = e.type == SDL_KEYDOWN;
+				my_event.data.key.released = e.type == SDL_KEYUP;
+				my_event.data.key.charcode = ev.keysym.sym;
+				my_event.data.key.mod      = ev.keysym.mod;
+				switch (ev.keysym.scancode)
+				{
+					case SDL_SCANCODE_UP           : my_event.data.key.keycode = Scancode::Up        ; break;
+					case SDL_SCANCODE_DOWN         : my_event.data.key.keycode = Scancode::Down      ; break;
+					case SDL_SCANCODE_LEFT         : my_event.data.key.keycode = Scancode::Left      ; break;
+					case SDL_SCANCODE_RIGHT        : my_event.data.key.keycode = Scancode::Right     ; break;
+					case SDL_SCANCODE_LCTRL        : my_event.data.key.keycode = Scancode::Ctrl      ; break;
+					case SDL_SCANCODE_RCTRL        : my_event.data.key.keycode = Scancode::Ctrl      ; break;
+					case SDL_SCANCODE_LSHIFT       : my_event.data.key.keycode = Scancode::Shift     ; break;
+					case SDL_SCANCODE_RSHIFT       : my_event.data.key.keycode = Scancode::Shift     ; break;
+					case SDL_SCANCODE_LALT         : my_event.data.key.keycode = Scancode::Alt       ; break;
+					case SDL_SCANCODE_RALT         : my_event.data.key.keycode = Scancode::Altgr     ; break;
+					case SDL_SCANCODE_KP_ENTER     : my_event.data.key.keycode = Scancode::Enter     ; break;
+					case SDL_SCANCODE_RETURN       : my_event.data.key.keycode = Scancode::Enter     ; break;
+					case SDL_SCANCODE_ESCAPE       : my_event.data.key.keycode = Scancode::Esc       ; break;
+					case SDL_SCANCODE_F1           : my_event.data.key.keycode = Scancode::F1        ; break;
+					case SDL_SCANCODE_F2           : my_event.data.key.keycode = Scancode::F2        ; break;
+					case SDL_SCANCODE_F12          : my_event.data.key.keycode = Scancode::F12       ; break;
+					case SDL_SCANCODE_BACKSPACE    : my_event.data.key.keycode = Scancode::Backspace ; break;
+					case SDL_SCANCODE_KP_BACKSPACE : my_event.data.key.keycode = Scancode::Backspace ; break;
+					case SDL_SCANCODE_DELETE       : my_event.data.key.keycode = Scancode::Delete    ; break;
+
+						
+					default:
+						break;
+				}
+				for(auto & window : windows)
+					if (window->sdl_window == sdl_window)
 					{
-						SDL_TextInputEvent & ev = (SDL_TextInputEvent&) e;
-						SDL_Window * sdl_window = SDL_GetWindowFromID(ev.windowID);
-						if ( ! sdl_window)
-							break;
-						event my_event{event_type::text, 0};
-						my_event.data.text.composition   = ev.text;
-						my_event.data.text.cursor_pos    = strlen(ev.text);
-						my_event.data.text.selection_len = 0;
-						for(auto & window : windows)
-							if (window->sdl_window == sdl_window)
-							{
-								window->handle_event(my_event);
-								break;
-							}
+						window->handle_event(my_event);
 						break;
 					}
-					case SDL_TEXTEDITING:
+				break;
+			}
+			case SDL_TEXTINPUT:
+			{
+				SDL_TextInputEvent & ev = (SDL_TextInputEvent&) e;
+				SDL_Window * sdl_window = SDL_GetWindowFromID(ev.windowID);
+				if ( ! sdl_window)
+					break;
+				event my_event{event_type::text, 0};
+				my_event.data.text.composition   = ev.text;
+				my_event.data.text.cursor_pos    = strlen(ev.text);
+				my_event.data.text.selection_len = 0;
+				for(auto & window : windows)
+					if (window->sdl_window == sdl_window)
 					{
-						SDL_TextEditingEvent & ev = (SDL_TextEditingEvent&) e;
-						SDL_Window * sdl_window = SDL_GetWindowFromID(ev.windowID);
-						if ( ! sdl_window)
-							break;
-						event my_event{event_type::text, 0};
-						my_event.data.text.composition   = ev.text;
-						my_event.data.text.cursor_pos    = ev.start;
-						my_event.data.text.selection_len = ev.length;
-						for(auto & window : windows)
-							if (window->sdl_window == sdl_window)
-							{
-								window->handle_event(my_event);
-								break;
-							}
+						window->handle_event(my_event);
 						break;
 					}
-					case SDL_QUIT:
-						return;
-				}
+				break;
 			}
-
-			// wait before processing the next frame
-			SDL_Delay(10); 
+			case SDL_TEXTEDITING:
+			{
+				SDL_TextEditingEvent & ev = (SDL_TextEditingEvent&) e;
+				SDL_Window * sdl_window = SDL_GetWindowFromID(ev.windowID);
+				if ( ! sdl_window)
+					break;
+				event my_event{event_type::text, 0};
+				my_event.data.text.composition   = ev.text;
+				my_event.data.text.cursor_pos    = ev.start;
+				my_event.data.text.selection_len = ev.length;
+				for(auto & window : windows)
+					if (window->sdl_window == sdl_window)
+					{
+						window->handle_event(my_event);
+						break;
+					}
+				break;
+			}
+			case SDL_QUIT:
+				return false;
 		}
+		return true;
 	}
 };
\ No newline at end of file
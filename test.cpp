@@ -0,0 +1,81 @@
+#include <iostream>
+
+#include "headless_wrapper.hpp"
+#include "our_windows.hpp"
+#include "ourgrid.hpp"
+
+// Checks of the grid, run on a headless window:
+//   make test
+
+using TestW = OW<Headless>;
+
+struct test_window : TestW::Window
+{
+	TestW::Container top_container;
+	TestW::TextEdit text1;
+	Grid<TestW> grid1;
+
+	test_window(const char * title, int width, int height)
+		: TestW::Window(title, width, height)
+		, top_container(this)
+		, text1(this, "")
+		, grid1(this, text1)
+	{
+		global_grid = &grid1;
+
+		this->top_container.set_layout(std::make_unique<TestW::VLayout>(horizontal_policy{horizontal_policy::alignment_t::left, horizontal_policy::sizing_t::fill}
+		                                                               ,  vertical_policy{  vertical_policy::alignment_t::top ,   vertical_policy::sizing_t::fill}));
+		this->top_container.add_widget(text1);
+		this->top_container.add_widget(grid1);
+		top_container.set_size({w, h});
+		this->container.add_widget(top_container);
+	}
+};
+
+int failures = 0;
+
+void check(bool ok, const char * what)
+{
+	if ( ! ok)
+	{
+		std::cout << "FAILED: " << what << std::endl;
+		++failures;
+	}
+}
+
+void test_native_formulas(Grid<TestW> & grid)
+{
+	// A01 isn't a cell for python, nor for the native evaluator
+	check(compile_native_formula("=A01+1").empty(), "=A01+1 is left to python");
+	check(extract_cell_references("=A01+1", 1).empty(), "=A01+1 refers to no cell");
+
+	grid.set_formula_at(0, 1, "=2");
+	grid.set_formula_at(1, 0, "=A01+1");
+	grid.set_formula_at(1, 1, "=A1+1");
+	grid.wait_for_evaluation();
+	check(grid.get_cell_at(1, 0) && grid.get_cell_at(1, 0)->error, "=A01+1 is an error, as in python");
+	check(grid.get_cell_at(1, 1) && ! grid.get_cell_at(1, 1)->error && grid.get_value_at(1, 1) == "3", "=A1+1 is 3");
+}
+
+void test_insert_during_evaluation(Grid<TestW> & grid)
+{
+	// the evaluation still running, the pending cell moves with the inserted column
+	grid.set_formula_at(3, 0, "=sum(range(10**6))");
+	grid.update_evaluation();
+	grid.insert_columns(1, 3);
+	grid.wait_for_evaluation();
+	check(grid.get_cell_at(3, 0) == nullptr, "the inserted column is empty");
+	check(grid.get_cell_at(4, 0) && ! grid.get_cell_at(4, 0)->pending && grid.get_value_at(4, 0) == "499999500000", "the moved cell is evaluated");
+}
+
+int main()
+{
+	TestW::Manager wm;
+	auto & window = (test_window&)wm.make_window<test_window>("OurCalc test", 800, 600);
+
+	test_native_formulas(window.grid1);
+	test_insert_during_evaluation(window.grid1);
+
+	std::cout << (failures ? "some checks failed" : "all checks passed") << std::endl;
+	return failures ? 1 : 0;
+}
@@ -4,6 +4,12 @@
 #include <vector>
 #include <utility>
 #include <functional>
+#include <memory>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+#include <tuple>
+#include <atomic>
 
 template<typename E>
 struct monitorable;
@@ -57,3 +63,235 @@ struct monitorable
 		std::erase_if(monitors, [m](monitor<E> * monitor) { return monitor == m; }); 
 	}
 };
+
+// Sparse two dimensional storage. Values are grouped in fixed-size blocks, a block
+// is allocated when its first value is created and only holds the created values,
+// so the memory used is proportional to the number of values, not to the area.
+template<typename V, unsigned int block_cols = 16, unsigned int block_rows = 64>
+struct chunked_grid
+{
+	struct block
+	{
+		std::vector<uint16_t> indices; // sorted
+		std::vector<std::unique_ptr<V>> values;
+	};
+	std::unordered_map<uint64_t, block> blocks;
+	size_t value_count = 0;
+
+	static_assert(block_cols * block_rows <= 0x10000);
+
+	static uint64_t block_key(unsigned int col, unsigned int row)
+	{
+		return (uint64_t(col / block_cols) << 32) | (row / block_rows);
+	}
+	static uint16_t index_in_block(unsigned int col, unsigned int row)
+	{
+		return (row % block_rows) * block_cols + col % block_cols;
+	}
+
+	V * get(unsigned int col, unsigned int row)
+	{
+		auto b = blocks.find(block_key(col, row));
+		if (b == std::end(blocks))
+			return nullptr;
+		auto & indices = b->second.indices;
+		auto index = index_in_block(col, row);
+		auto it = std::lower_bound(std::begin(indices), std::end(indices), index);
+		if (it == std::end(indices) || *it != index)
+			return nullptr;
+		return b->second.values[it - std::begin(indices)].get();
+	}
+
+	// make() returns a new V, allocated with new
+	template<typename F>
+	V * get_or_create(unsigned int col, unsigned int row, F make)
+	{
+		auto & b = blocks[block_key(col, row)];
+		auto index = index_in_block(col, row);
+		auto it = std::lower_bound(std::begin(b.indices), std::end(b.indices), index);
+		auto pos = it - std::begin(b.indices);
+		if (it != std::end(b.indices) && *it == index)
+			return b.values[pos].get();
+		b.indices.insert(it, index);
+		b.values.emplace(std::next(std::begin(b.values), pos), make());
+		++value_count;
+		return b.values[pos].get();
+	}
+
+	void erase(unsigned int col, unsigned int row)
+	{
+		auto b = blocks.find(block_key(col, row));
+		if (b == std::end(blocks))
+			return;
+		auto & indices = b->second.indices;
+		auto index = index_in_block(col, row);
+		auto it = std::lower_bound(std::begin(indices), std::end(indices), index);
+		if (it == std::end(indices) || *it != index)
+			return;
+		b->second.values.erase(std::next(std::begin(b->second.values), it - std::begin(indices)));
+		indices.erase(it);
+		--value_count;
+		if (indices.empty())
+			blocks.erase(b);
+	}
+
+	size_t size() const
+	{
+		return value_count;
+	}
+
+	// f(col, row, value)
+	template<typename F>
+	void for_each(F f)
+	{
+		for (auto & [key, b] : blocks)
+		{
+			unsigned int first_col = (key >> 32) * block_cols;
+			unsigned int first_row = (key & 0xffffffff) * block_rows;
+			for (size_t i=0 ; i<b.indices.size() ; ++i)
+				f(first_col + b.indices[i] % block_cols, first_row + b.indices[i] / block_cols, *b.values[i]);
+		}
+	}
+
+	// moves the values at or after the given column/row by count
+	void insert_cols(unsigned int count, unsigned int before_col)
+	{
+		move_values([=](unsigned int & col, unsigned int &) { if (col >= before_col) col += count; });
+	}
+	void insert_rows(unsigned int count, unsigned int before_row)
+	{
+		move_values([=](unsigned int &, unsigned int & row) { if (row >= before_row) row += count; });
+	}
+
+private:
+	template<typename F>
+	void move_values(F move)
+	{
+		std::vector<std::tuple<unsigned int, unsigned int, std::unique_ptr<V>>> moved;
+		for (auto & [key, b] : blocks)
+		{
+			unsigned int first_col = (key >> 32) * block_cols;
+			unsigned int first_row = (key & 0xffffffff) * block_rows;
+			for (size_t i=0 ; i<b.indices.size() ; ++i)
+			{
+				unsigned int col = first_col + b.indices[i] % block_cols;
+				unsigned int row = first_row + b.indices[i] / block_cols;
+				move(col, row);
+				moved.emplace_back(col, row, std::move(b.values[i]));
+			}
+		}
+		blocks.clear();
+		value_count = 0;
+		for (auto & t : moved)
+			get_or_create(std::get<0>(t), std::get<1>(t), [&t]() { return std::get<2>(t).release(); });
+	}
+};
+
+// Values with O(log n) updates and prefix sums (Fenwick tree).
+// Used for the sizes of rows and columns, to convert between indices and positions.
+template<typename V>
+struct prefix_sum_tree
+{
+	std::vector<V> values;
+	std::vector<V> tree; // 1-based, tree[i] is the sum of the values ]i-lowbit(i), i]
+
+	size_t size() const
+	{
+		return values.size();
+	}
+	V operator[](size_t i) const
+	{
+		return values[i];
+	}
+
+	void set(size_t i, V value)
+	{
+		V delta = value - values[i];
+		values[i] = value;
+		for (size_t j=i+1 ; j<tree.size() ; j+=j&-j)
+			tree[j] += delta;
+	}
+	void insert(size_t before_idx, size_t count, V value)
+	{
+		values.insert(std::next(std::begin(values), before_idx), count, value);
+		rebuild();
+	}
+
+	// sum of the first n values
+	V sum(size_t n) const
+	{
+		V result = 0;
+		for ( ; n>0 ; n-=n&-n)
+			result += tree[n];
+		return result;
+	}
+	V total() const
+	{
+		return sum(size());
+	}
+	// number of leading values whose sum is <= s,
+	// which is the index of the value covering the offset s, or size() past the end
+	size_t find(V s) const
+	{
+		size_t pos = 0;
+		size_t step = 1;
+		while (step*2 < tree.size())
+			step *= 2;
+		for ( ; step>0 ; step/=2)
+			if (pos+step < tree.size() && tree[pos+step] <= s)
+			{
+				pos += step;
+				s -= tree[pos];
+			}
+		return pos;
+	}
+
+private:
+	void rebuild()
+	{
+		tree.assign(values.size()+1, 0);
+		for (size_t i=1 ; i<tree.size() ; ++i)
+		{
+			tree[i] += values[i-1];
+			size_t parent = i + (i&-i);
+			if (parent < tree.size())
+				tree[parent] += tree[i];
+		}
+	}
+};
+
+// Bounded queue between one producing thread and one consuming thread, without locks
+template<typename T>
+struct spsc_queue
+{
+	spsc_queue(size_t capacity)
+		: slots(capacity+1) // one slot always empty, telling a full queue from an empty one
+	{}
+
+	// false if the queue is full, value being left untouched
+	bool push(T && value)
+	{
+		size_t t = tail.load(std::memory_order_relaxed);
+		size_t next = (t+1) % slots.size();
+		if (next == head.load(std::memory_order_acquire))
+			return false;
+		slots[t] = std::move(value);
+		tail.store(next, std::memory_order_release);
+		return true;
+	}
+	// false if the queue is empty
+	bool pop(T & value)
+	{
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire))
+			return false;
+		value = std::move(slots[h]);
+		head.store((h+1) % slots.size(), std::memory_order_release);
+		return true;
+	}
+
+private:
+	std::vector<T> slots;
+	std::atomic<size_t> head = 0; // next to pop, written by the consumer
+	std::atomic<size_t> tail = 0; // next to push, written by the producer
+};
@@ -0,0 +1,181 @@
+
+#pragma once
+
+#include <random>
+#include <string>
+
+#include "ourgrid.hpp"
+
+// Sheets of a given shape, the same for the same seed, as input of the
+// performance measurements. Cells are written in a block of width columns,
+// row by row from A0, the way a user would type them.
+struct workbook_shape
+{
+	enum class kind_t
+	{
+		chain,      // each cell adds one to the previous one
+		fan_out,    // every cell depends on the first one
+		fan_in,     // numbers, summed by a range in the column after the block
+		random_dag, // each formula refers to a few cells written before it
+		literals,   // texts, numbers, dates, booleans and lists, no formula
+		mixed,      // literals and formulas referring to the numbers before them
+	};
+
+	kind_t kind = kind_t::chain;
+	unsigned int cells = 1000;
+	unsigned int width = 10;
+	unsigned int max_inputs = 4; // references by formula, random_dag and mixed
+	unsigned int seed = 42;
+};
+
+inline const char * workbook_kind_name(workbook_shape::kind_t kind)
+{
+	switch (kind)
+	{
+		case workbook_shape::kind_t::chain:      return "chain";
+		case workbook_shape::kind_t::fan_out:    return "fan_out";
+		case workbook_shape::kind_t::fan_in:     return "fan_in";
+		case workbook_shape::kind_t::random_dag: return "random_dag";
+		case workbook_shape::kind_t::literals:   return "literals";
+		case workbook_shape::kind_t::mixed:      return "mixed";
+	}
+	return "";
+}
+
+// Position of the i-th cell written
+inline CellCoords workbook_cell(const workbook_shape & shape, unsigned int i)
+{
+	return CellCoords{i % shape.width, i / shape.width};
+}
+
+// Empties the grid, and gives it at least the given size
+template<typename G>
+void clear_workbook(G & grid, unsigned int cols, unsigned int rows)
+{
+	std::vector<std::pair<CellCoords, icu::UnicodeString>> edits;
+	grid.cell_data.for_each([&](unsigned int col, unsigned int row, CellData & cell)
+		{
+			if (cell.formula.length() != 0)
+				edits.push_back({CellCoords{col, row}, ""});
+		});
+	grid.set_formulas(edits);
+	grid.wait_for_evaluation();
+	if (grid.get_col_count() < cols)
+		grid.insert_columns(cols - grid.get_col_count(), grid.get_col_count());
+	if (grid.get_row_count() < rows)
+		grid.insert_rows(rows - grid.get_row_count(), grid.get_row_count());
+}
+
+template<typename G>
+void generate_workbook(G & grid, const workbook_shape & shape)
+{
+	clear_workbook(grid, shape.width + 1, shape.cells / shape.width + 1);
+
+	// written all at once, like a paste
+	std::vector<std::pair<CellCoords, icu::UnicodeString>> edits;
+	std::mt19937 rng(shape.seed);
+	auto random = [&](unsigned int n) { return (unsigned int)(rng() % n); };
+	auto name = [&](unsigned int i)
+		{
+			auto p = workbook_cell(shape, i);
+			return get_cell_name_string(p.x, p.y);
+		};
+	auto write = [&](unsigned int i, const std::string & text)
+		{
+			edits.push_back({workbook_cell(shape, i), icu::UnicodeString::fromUTF8(text)});
+		};
+	// one random number by statement, the order of evaluation of operands being unspecified
+	auto literal = [&](bool & is_number)
+		{
+			unsigned int kind = random(6);
+			is_number = kind <= 1;
+			unsigned int a = random(100000);
+			if (kind == 0)
+				return std::to_string(a);
+			if (kind == 1)
+			{
+				unsigned int b = random(100);
+				return std::to_string(a) + "." + std::to_string(b);
+			}
+			if (kind == 2)
+				return std::string("item ") + std::to_string(a % 1000);
+			if (kind == 3)
+			{
+				unsigned int month = 1 + random(12);
+				unsigned int day = 1 + random(28);
+				return std::to_string(2000 + a % 30) + "-" + std::to_string(month) + "-" + std::to_string(day);
+			}
+			if (kind == 4)
+				return std::string(a % 2 ? "True" : "False");
+			unsigned int b = random(10);
+			return "[" + std::to_string(a % 10) + ", " + std::to_string(b) + "]";
+		};
+	// formula over up to max_inputs of the given cells
+	auto formula = [&](const std::vector<unsigned int> & cells)
+		{
+			std::string result = "=" + name(cells[random(cells.size())]);
+			unsigned int inputs = 1 + random(shape.max_inputs);
+			for (unsigned int k=1 ; k<inputs ; ++k)
+			{
+				const char * ops[] = {"+", "-", "*"};
+				const char * op = ops[random(3)];
+				result += op + name(cells[random(cells.size())]);
+			}
+			return result;
+		};
+	// the cells written so far that formulas can refer to
+	std::vector<unsigned int> numbers;
+
+	switch (shape.kind)
+	{
+		case workbook_shape::kind_t::chain:
+			write(0, "=1");
+			for (unsigned int i=1 ; i<shape.cells ; ++i)
+				write(i, "=" + name(i-1) + "+1");
+			break;
+		case workbook_shape::kind_t::fan_out:
+			write(0, "=1");
+			for (unsigned int i=1 ; i<shape.cells ; ++i)
+				write(i, "=" + name(0) + "*" + std::to_string(1 + random(10)));
+			break;
+		case workbook_shape::kind_t::fan_in:
+		{
+			for (unsigned int i=0 ; i<shape.cells ; ++i)
+				write(i, "=" + std::to_string(random(1000)));
+			auto last = workbook_cell(shape, shape.cells-1);
+			std::string range = name(0) + ":" + get_cell_name_string(shape.width-1, last.y);
+			edits.push_back({CellCoords{shape.width, 0}, icu::UnicodeString::fromUTF8("=sum(" + range + ")")});
+			break;
+		}
+		case workbook_shape::kind_t::random_dag:
+			write(0, "=1");
+			numbers.push_back(0);
+			for (unsigned int i=1 ; i<shape.cells ; ++i)
+			{
+				write(i, random(10) ? formula(numbers) : "=" + std::to_string(random(1000)));
+				numbers.push_back(i);
+			}
+			break;
+		case workbook_shape::kind_t::literals:
+			for (unsigned int i=0 ; i<shape.cells ; ++i)
+			{
+				bool is_number;
+				write(i, literal(is_number));
+			}
+			break;
+		case workbook_shape::kind_t::mixed:
+			// formulas refer to numbers only, not to measure errors
+			write(0, "=1");
+			numbers.push_back(0);
+			for (unsigned int i=1 ; i<shape.cells ; ++i)
+			{
+				bool is_number = true;
+				write(i, random(4) ? formula(numbers) : literal(is_number));
+				if (is_number)
+					numbers.push_back(i);
+			}
+			break;
+	}
+	grid.set_formulas(edits);
+	grid.wait_for_evaluation();
+}